@@ -1,7 +1,7 @@
 cmake_minimum_required(VERSION 3.19.0)
 
 # Install the engine
-install(TARGETS montezuma)
+install(TARGETS montezuma montezuma_bookexpand montezuma_dataprep)
 
 # Package it
 set(CPACK_PACKAGE_VENDOR "Michele Bolognini")
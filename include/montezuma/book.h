@@ -7,6 +7,7 @@
  * Definitions for opening book management
  */
  
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include "hashing.h"
@@ -32,8 +33,10 @@ public:
     bool initialize(std::string fileName);
     // Provides a list of polyBookEntries representing the suggested moves
     bool listMoves(uint64_t hash, std::vector<polyBookEntry> &moves);
-    // Return the suggested best move in the current position
+    // Return the suggested best move in the current position, in UCI notation. moveTerse must hold 6 chars
     bool getMove(thc::ChessEvaluation cr, uint64_t hash, char* moveTerse);
+    // All the entries read from the book, fields are kept in the file's (big endian) byte order
+    const std::vector<polyBookEntry> &entries() const;
     
 private:
     
@@ -44,6 +47,13 @@ private:
 unsigned short endianSwapU16(unsigned short x);
 unsigned int endianSwapU32(unsigned int x);
 uint64_t endianSwapU64 (uint64_t x);
+
+// Converts a Polyglot move (host byte order) into the corresponding legal move in cr. Returns false if it is not legal
+bool polyMoveToMove(thc::ChessRules &cr, unsigned short polyMove, thc::Move &mv);
+// Converts a move into its Polyglot encoding (host byte order), castling is encoded as "king captures rook"
+unsigned short moveToPolyMove(thc::Move mv);
+// Writes the entries (host byte order) to fileName as a Polyglot book, sorted by key and decreasing weight
+bool writeBook(std::string fileName, std::vector<polyBookEntry> entries);
     
 } // end namespace montezuma
 
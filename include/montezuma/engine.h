@@ -13,12 +13,15 @@
 #include "thc.h"
 #include "hashing.h"
 #include "book.h"
+#include "scheduler.h"
+#include "metrics.h"
 
 namespace montezuma
 {
 
 #define MOVE_MAX 1000
 #define MATE_SCORE 100000
+#define CHECKPOINT_NODES 4096 // Nodes searched between two scheduler checkpoints
 
     struct line
     {
@@ -33,6 +36,11 @@ namespace montezuma
         Engine(std::istream &inputStream = std::cin, std::ostream &outputStream = std::cout);
         /* Effectively starts the engine, listening for command */
         int protocolLoop();
+        /* Searches the position given as FEN to a fixed depth, without consulting the book or printing a bestmove.
+           Returns the score from the point of view of the side to move, bestMove is left untouched if there is none */
+        int searchPosition(const std::string &fen, unsigned int depth, thc::Move &bestMove);
+        /* Parses and applies a "setoption" command, as received after the "setoption" token */
+        void setOption(std::istream &commandStream);
 
     private:
         void uciHandShake() const;
@@ -43,9 +51,13 @@ namespace montezuma
         void initHashTable();
         /* Plays the listed moves on the Engine's board */
         void updatePosition(const std::string command);
-        /* Called when Engine receives the "go" command */
-        void inputGo(const std::string command);
-        void startSearching(const std::string command);
+        /* Called when Engine receives the "go" command, received is when it was read */
+        void inputGo(const std::string command, std::chrono::steady_clock::time_point received);
+        void startSearching(const std::string command, std::chrono::steady_clock::time_point received);
+        /* Iteratively deepens the search of the current position up to maxSearchDepth, returns the last score */
+        int iterativeDeepening(unsigned int maxSearchDepth);
+        /* Decides whether the search about to start is interactive or batch, according to the searchClass option */
+        void selectSearchClass();
         /* Search function */
         int alphaBeta(int alpha, int beta, int depth, line *pvLine, int initialDepth);
         /* Evaluation function, evaluates the engine's current board */
@@ -59,7 +71,6 @@ namespace montezuma
         void retrievePvLineFromTable(line *pvLine, std::set<uint64_t> &hashHistory);
         /* Checks if the current hash has appeared at least other 2 times in history */
         bool isThreefoldRepetitionHash();
-        void setOption(std::istream &commandStream);
         /* Perform some debugging tasks */
         void debug();
 
@@ -72,7 +83,8 @@ namespace montezuma
         std::vector<hashEntry> hashTable_;
         unsigned int hashTableSize_; // Given in MB
         unsigned int numPositions_;
-        unsigned int tableHits_;
+        unsigned long long tableProbes_{0}; // Since the start of the search iteration
+        unsigned long long tableHits_{0};
         unsigned int tableEntries_;
         line globalPvLine_;
         bool usingPreviousLine_;
@@ -84,6 +96,10 @@ namespace montezuma
         unsigned int maxSearchDepth_{6};
         std::ofstream logFile_;
         Book book_;
+        std::string searchClassOption_{"auto"};
+        SearchClass searchClass_{SearchClass::INTERACTIVE};
+        unsigned int nodesSinceCheckpoint_{0};
+        std::chrono::microseconds suspendedTime_{0}; // Spent suspended by the scheduler since the start of the search iteration
         bool isOpening_;
         std::istream &inputStream_;
         std::ostream &outputStream_;
@@ -0,0 +1,125 @@
+/*
+ * File:   metrics.h
+ *
+ * Process-wide counters of the engines, exported in the Prometheus text format.
+ * Every thread updates its own block of counters, so recording never contends;
+ * blocks are only summed when the metrics are exported.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "scheduler.h"
+
+namespace montezuma
+{
+
+#define LATENCY_SUB_BUCKETS 8  // Buckets every power of two of microseconds is split into
+#define LATENCY_BUCKETS 296    // Up to 2^39 microseconds, about 6 days
+#define OVERRUN_MARGIN_MS 50   // A clocked search overruns when it answers this much after its time allocation
+
+    enum class Command
+    {
+        UCI,
+        ISREADY,
+        UCINEWGAME,
+        SETOPTION,
+        POSITION,
+        GO,
+        OTHER,
+        COUNT
+    };
+
+    Command commandFromName(const std::string &name);
+
+    struct metricsSnapshot
+    {
+        uint64_t searches[2]{};     // Completed searches, by SearchClass
+        uint64_t nodes[2]{};        // Positions evaluated, by SearchClass
+        uint64_t searchMicros[2]{}; // Time spent searching, by SearchClass
+        uint64_t ttProbes{0};
+        uint64_t ttHits{0};
+        uint64_t bookProbes{0};
+        uint64_t bookHits{0};
+        uint64_t timedSearches{0};
+        uint64_t overruns{0};
+        uint64_t latency[static_cast<int>(Command::COUNT)][LATENCY_BUCKETS]{};
+        uint64_t latencyMicros[static_cast<int>(Command::COUNT)]{};
+    };
+
+    /* Counters of a single thread. Only the owning thread writes them, the exporter reads them */
+    struct alignas(64) threadCounters
+    {
+        std::atomic<uint64_t> searches[2]{};
+        std::atomic<uint64_t> nodes[2]{};
+        std::atomic<uint64_t> searchMicros[2]{};
+        std::atomic<uint64_t> ttProbes{0};
+        std::atomic<uint64_t> ttHits{0};
+        std::atomic<uint64_t> bookProbes{0};
+        std::atomic<uint64_t> bookHits{0};
+        std::atomic<uint64_t> timedSearches{0};
+        std::atomic<uint64_t> overruns{0};
+        std::atomic<uint64_t> latency[static_cast<int>(Command::COUNT)][LATENCY_BUCKETS]{};
+        std::atomic<uint64_t> latencyMicros[static_cast<int>(Command::COUNT)]{};
+
+        void addTo(metricsSnapshot &snapshot) const;
+    };
+
+    class Metrics
+    {
+    public:
+        /* The metrics are shared by all the engines of the process */
+        static Metrics &instance();
+        ~Metrics();
+        /* Accounts the work of a search iteration */
+        void addSearchWork(SearchClass searchClass, uint64_t nodes, std::chrono::microseconds duration, uint64_t ttProbes, uint64_t ttHits);
+        /* Accounts a completed search. allocatedMs is the time it was given, 0 if it was not clocked */
+        void recordSearch(SearchClass searchClass, std::chrono::microseconds duration, unsigned long allocatedMs);
+        void recordBookProbe(bool hit);
+        /* Accounts the time from the reception of a command to its answer */
+        void recordCommand(Command command, std::chrono::microseconds latency);
+        /* Sums the counters of all threads, past and present */
+        metricsSnapshot snapshot() const;
+        std::string prometheusText();
+        /* Starts writing the metrics every exportInterval seconds to target, either a file or "unix:<socket path>".
+           An empty target stops the export */
+        void setExportTarget(const std::string &target);
+        void setExportInterval(unsigned int seconds);
+
+    private:
+        Metrics() = default;
+        /* Counters of the calling thread, registered on first use and folded into retired_ when the thread exits */
+        threadCounters &local();
+        void unregister(threadCounters *counters);
+        void stopExport();
+        void exportLoop();
+        bool writeMetrics(const std::string &target, const std::string &text) const;
+
+        friend struct threadSlot;
+
+        mutable std::mutex registryMutex_;
+        std::vector<threadCounters *> liveCounters_;
+        metricsSnapshot retired_;
+        // Totals at the previous export, to compute the recent speed of the search
+        uint64_t lastNodes_{0};
+        uint64_t lastSearchMicros_{0};
+
+        std::mutex exportMutex_;
+        std::condition_variable exportStop_;
+        bool stopping_{false};
+        std::string exportTarget_;
+        std::chrono::seconds exportInterval_{10};
+        std::thread exporter_;
+    };
+
+} // end namespace montezuma
+
+#endif /* METRICS_H */
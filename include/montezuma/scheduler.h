@@ -0,0 +1,93 @@
+/*
+ * File:   scheduler.h
+ *
+ * Shares the cores of the process between concurrent searches.
+ * Interactive (clocked) searches are always served first, batch searches are
+ * time-sliced onto the remaining slots and suspended at their checkpoints.
+ * Processes given the same slot directory also share their slots, through lock files:
+ * slot-<n>.lock is held by the search running on slot n, interactive.lock and batch.lock
+ * are held shared by the searches waiting for one.
+ */
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace montezuma
+{
+
+    enum class SearchClass
+    {
+        INTERACTIVE,
+        BATCH
+    };
+
+    struct schedulerStats
+    {
+        unsigned long long searches{0};    // Completed searches
+        unsigned long long preemptions{0}; // Times a running search gave its slot away
+        unsigned long long nodes{0};       // Positions evaluated by completed searches
+        unsigned long long waitMs{0};      // Total time spent waiting for a slot
+        unsigned long long maxWaitMs{0};   // Longest single wait for a slot
+        unsigned long long runMs{0};       // Total time spent holding a slot
+    };
+
+    class Scheduler
+    {
+    public:
+        /* The scheduler is shared by all the engines of the process */
+        static Scheduler &instance();
+        /* Number of searches allowed to run at the same time */
+        void setSlots(unsigned int slots);
+        unsigned int slots() const;
+        /* Shares the slots with the other processes using the same directory, which should all set the same
+           number of slots. An empty directory stops sharing. Returns false if the directory is not usable */
+        bool setSlotDirectory(const std::string &directory);
+        /* Blocks until a slot is available for a search of the given class */
+        void acquire(SearchClass searchClass);
+        void release(SearchClass searchClass);
+        /* Called by a running search at iteration and node batch boundaries. A batch search gives its slot away
+           when an interactive search is waiting, or when its time slice is over and another batch search is waiting,
+           and blocks until it is scheduled again. Returns the time the search was suspended */
+        std::chrono::microseconds checkpoint(SearchClass searchClass);
+        /* Accounts a completed search */
+        void recordSearch(SearchClass searchClass, unsigned long long nodes);
+        schedulerStats stats(SearchClass searchClass) const;
+
+    private:
+        Scheduler();
+        /* All expect mutex_ to be held by lock. takeSlot gets a slot in this process, then one on the host if shared.
+           A search that yielded its slot lets the searches of other processes waiting at that time go first */
+        void takeSlot(SearchClass searchClass, std::unique_lock<std::mutex> &lock, bool yielded = false);
+        void giveSlot(SearchClass searchClass);
+        void waitForSlot(SearchClass searchClass, std::unique_lock<std::mutex> &lock);
+        void freeSlot(SearchClass searchClass);
+        /* Host-wide slots, polled since other processes cannot signal us */
+        void acquireHostSlot(SearchClass searchClass, const std::string &directory, unsigned int slots, bool yielded);
+        void releaseHostSlot();
+        /* Whether some search holds the marker file, i.e. is waiting for a slot */
+        bool hostWaiting(const std::string &marker) const;
+
+        mutable std::mutex mutex_;
+        std::condition_variable slotFreed_;
+        unsigned int slots_;
+        unsigned int busySlots_{0};
+        unsigned int interactiveWaiting_{0};
+        std::deque<unsigned long long> batchQueue_; // Tickets of the waiting batch searches, served in order
+        unsigned long long nextTicket_{0};
+        std::chrono::milliseconds timeSlice_{100};
+        std::string slotDirectory_;
+        std::chrono::milliseconds hostPollInterval_{5};
+        std::chrono::milliseconds hostCheckInterval_{10};
+        schedulerStats stats_[2];
+    };
+
+} // end namespace montezuma
+
+#endif /* SCHEDULER_H */
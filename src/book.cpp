@@ -47,30 +47,98 @@ bool Book::listMoves(uint64_t hash, std::vector<polyBookEntry> &moves){
 
 bool Book::getMove(thc::ChessEvaluation cr, uint64_t hash, char* moveTerse){
     
-    bool found = false;
     std::vector<polyBookEntry> moves;
-    // Choose best move and convert it to thc standard
+    // Choose best move and convert it to thc standard, skipping entries that are not legal here (key collisions)
     
     if(listMoves(hash, moves)){
-        found = true;
-        unsigned short mv = endianSwapU16(moves[0].move);
-        moveTerse[0] = ((mv>>6) & 7 )+'a';
-        moveTerse[1] = ((mv>>9) & 7 )+1+'0';
-        moveTerse[2] = (mv & 7)+'a';
-        moveTerse[3] = ((mv>>3) & 7 )+1+'0';
-        if (mv>>12){ // If promotion, remember to add it
-            char promotionPieces[5] = {'?', 'n', 'b', 'r', 'q'};
-            moveTerse[4] = '=';
-            moveTerse[5] = promotionPieces[(mv>>12)];
-        } else {
-            moveTerse[4] = '\0';
+        for (auto entry:moves){
+            thc::Move mv;
+            if (!polyMoveToMove(cr, endianSwapU16(entry.move), mv))
+                continue;
+            std::string terse = mv.TerseOut(); // UCI form, castling as the king's move and promotions as e7e8q
+            terse.copy(moveTerse, 5);
+            moveTerse[std::min<size_t>(terse.size(), 5)] = '\0';
+            // If using weight, remember to endianSwapU16(entry.weight));
+            return true;
         }
-        // If using weight, remember to endianSwapU16(entry.weight));
     }
     
-    return found;
+    return false;
+}
+
+const std::vector<polyBookEntry> &Book::entries() const{
+    return positionList_;
 }
 
+bool polyMoveToMove(thc::ChessRules &cr, unsigned short polyMove, thc::Move &mv){
+    char moveTerse[6];
+    moveTerse[0] = ((polyMove>>6) & 7)+'a';
+    moveTerse[1] = ((polyMove>>9) & 7)+'1';
+    moveTerse[2] = (polyMove & 7)+'a';
+    moveTerse[3] = ((polyMove>>3) & 7)+'1';
+    moveTerse[4] = '\0';
+    moveTerse[5] = '\0';
+    if (polyMove>>12){ // Promotion piece
+        char promotionPieces[5] = {'?', 'n', 'b', 'r', 'q'};
+        moveTerse[4] = promotionPieces[(polyMove>>12) & 7];
+    }
+    // Polyglot encodes castling as the king capturing its own rook
+    std::string move(moveTerse);
+    char piece = cr.squares[8*(7-((polyMove>>9) & 7)) + ((polyMove>>6) & 7)]; // thc squares go from a8 to h1
+    if (piece == 'K' && move == "e1h1")
+        move = "e1g1";
+    else if (piece == 'K' && move == "e1a1")
+        move = "e1c1";
+    else if (piece == 'k' && move == "e8h8")
+        move = "e8g8";
+    else if (piece == 'k' && move == "e8a8")
+        move = "e8c8";
+    return mv.TerseIn(&cr, move.c_str());
+}
+
+unsigned short moveToPolyMove(thc::Move mv){
+    int srcFile = thc::get_file(mv.src)-'a', srcRank = thc::get_rank(mv.src)-'1';
+    int dstFile = thc::get_file(mv.dst)-'a', dstRank = thc::get_rank(mv.dst)-'1';
+    int promotion = 0;
+    switch (mv.special){
+        case thc::SPECIAL_WK_CASTLING:
+        case thc::SPECIAL_BK_CASTLING:
+            dstFile = 7;
+            break;
+        case thc::SPECIAL_WQ_CASTLING:
+        case thc::SPECIAL_BQ_CASTLING:
+            dstFile = 0;
+            break;
+        case thc::SPECIAL_PROMOTION_KNIGHT: promotion = 1; break;
+        case thc::SPECIAL_PROMOTION_BISHOP: promotion = 2; break;
+        case thc::SPECIAL_PROMOTION_ROOK:   promotion = 3; break;
+        case thc::SPECIAL_PROMOTION_QUEEN:  promotion = 4; break;
+        default: break;
+    }
+    return (promotion<<12) | (srcRank<<9) | (srcFile<<6) | (dstRank<<3) | dstFile;
+}
+
+bool writeBook(std::string fileName, std::vector<polyBookEntry> entries){
+    std::sort(entries.begin(), entries.end(), [](const polyBookEntry &a, const polyBookEntry &b){
+        return (a.key != b.key) ? a.key < b.key : a.weight > b.weight;
+    });
+    std::ofstream bookFile(fileName, std::ios::binary | std::ios::trunc);
+    if (!bookFile.is_open()){
+        std::cout << "info string unable to write book " << fileName << std::endl;
+        return false;
+    }
+    for (auto entry:entries){
+        uint64_t key = endianSwapU64(entry.key);
+        unsigned short move = endianSwapU16(entry.move);
+        unsigned short weight = endianSwapU16(entry.weight);
+        unsigned int learn = endianSwapU32(entry.learn);
+        bookFile.write(reinterpret_cast<char*>(&key), sizeof(key));
+        bookFile.write(reinterpret_cast<char*>(&move), sizeof(move));
+        bookFile.write(reinterpret_cast<char*>(&weight), sizeof(weight));
+        bookFile.write(reinterpret_cast<char*>(&learn), sizeof(learn));
+    }
+    return bookFile.good();
+}
     
 unsigned short endianSwapU16(unsigned short x){
     x = (x>>8) | (x<<8);
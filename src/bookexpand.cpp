@@ -0,0 +1,267 @@
+/*
+ * montezuma_bookexpand: extends a Polyglot opening book by searching the positions just outside of it.
+ *
+ * The book is walked from the initial position following the top weighted moves of every position.
+ * Positions reached this way that are not in the book form the frontier: each of them is searched
+ * to a fixed depth, in parallel, and its best move is added to the output book.
+ * Results are appended to a journal as soon as they are available, so an interrupted run can be resumed
+ * by launching the same command again. Feeding the output book back in expands it one more move deep.
+ */
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+#include "engine.h"
+
+namespace montezuma
+{
+
+    struct expandOptions
+    {
+        std::string inputBook;
+        std::string outputBook;
+        std::string journal;
+        unsigned int depth{8};        // Search depth of every frontier position
+        unsigned int maxPlies{16};    // Do not follow book lines longer than this
+        unsigned int width{2};        // Number of top weighted moves followed in every book position
+        unsigned int threads{std::max(1u, std::thread::hardware_concurrency())};
+        unsigned int hashSize{64};    // Per thread, in MB
+        unsigned short weight{1};     // Weight given to the new book entries
+        std::string slotDirectory;    // Shares the cores with the engines using the same slotDir
+    };
+
+    const unsigned long MAX_DEPTH = 64;    // Beyond any depth the engine can finish
+    const unsigned long MAX_PLIES = 1000;  // Beyond any book line
+    const unsigned long MAX_WIDTH = 256;   // Beyond the legal moves of any position
+    const unsigned long MAX_THREADS = 1024;
+
+    struct frontierPosition
+    {
+        uint64_t key;
+        std::string fen;
+    };
+
+    struct searchResult
+    {
+        uint64_t key;
+        unsigned short move; // Polyglot encoding
+        int score;
+        unsigned int depth;
+    };
+
+    void printUsage()
+    {
+        std::cout << "usage: montezuma_bookexpand <input.bin> <output.bin> [--depth N] [--plies N] [--width N]"
+                  << " [--threads N] [--hash MB] [--weight N] [--journal file] [--slot-dir dir]\n";
+    }
+
+    // Reads a number in [min, max]. stoul would wrap negative values around, they are rejected first
+    unsigned long parseNumber(const std::string &value, unsigned long min, unsigned long max)
+    {
+        if (value.find('-') != std::string::npos)
+            throw std::out_of_range(value);
+        size_t end;
+        unsigned long number = std::stoul(value, &end);
+        if (end != value.size() || number < min || number > max)
+            throw std::out_of_range(value);
+        return number;
+    }
+
+    bool parseOptions(int argc, char **argv, expandOptions &options)
+    {
+        if (argc < 3)
+            return false;
+        options.inputBook = argv[1];
+        options.outputBook = argv[2];
+        options.journal = options.outputBook + ".journal";
+        try
+        {
+            for (int i = 3; i < argc; i++)
+            {
+                std::string name = argv[i];
+                if (i + 1 >= argc)
+                    return false;
+                std::string value = argv[++i];
+                if (name.compare("--depth") == 0)
+                    options.depth = parseNumber(value, 1, MAX_DEPTH);
+                else if (name.compare("--plies") == 0)
+                    options.maxPlies = parseNumber(value, 0, MAX_PLIES);
+                else if (name.compare("--width") == 0)
+                    options.width = parseNumber(value, 1, MAX_WIDTH);
+                else if (name.compare("--threads") == 0)
+                    options.threads = parseNumber(value, 1, MAX_THREADS);
+                else if (name.compare("--hash") == 0)
+                    options.hashSize = parseNumber(value, 1, 128); // Same bounds as the hashSize option
+                else if (name.compare("--weight") == 0)
+                    options.weight = parseNumber(value, 1, 65535); // Polyglot weights are 16 bits
+                else if (name.compare("--journal") == 0)
+                    options.journal = value;
+                else if (name.compare("--slot-dir") == 0)
+                    options.slotDirectory = value;
+                else
+                    return false;
+            }
+        }
+        catch (const std::logic_error &) // Not a number, or out of its range
+        {
+            return false;
+        }
+        return true;
+    }
+
+    // Follows the top weighted book moves from cr, collecting the positions that leave the book
+    void collectFrontier(thc::ChessRules &cr, uint64_t hash, unsigned int ply, const expandOptions &options,
+                         const std::unordered_map<uint64_t, std::vector<polyBookEntry>> &bookIndex,
+                         std::unordered_set<uint64_t> &visited, std::map<uint64_t, std::string> &frontier)
+    {
+        if (!visited.insert(hash).second)
+            return;
+        auto found = bookIndex.find(hash);
+        if (found == bookIndex.end())
+        {
+            frontier[hash] = cr.ForsythPublish();
+            return;
+        }
+        if (ply >= options.maxPlies)
+            return;
+
+        std::vector<polyBookEntry> moves = found->second;
+        std::stable_sort(moves.begin(), moves.end(), [](const polyBookEntry &a, const polyBookEntry &b)
+                         { return a.weight > b.weight; });
+        if (moves.size() > options.width)
+            moves.resize(options.width);
+        for (auto entry : moves)
+        {
+            thc::Move mv;
+            if (!polyMoveToMove(cr, entry.move, mv))
+                continue; // Corrupted entry, or hash collision
+            uint64_t childHash = zobristHash64Update(hash, cr, mv);
+            cr.PushMove(mv);
+            collectFrontier(cr, childHash, ply + 1, options, bookIndex, visited, frontier);
+            cr.PopMove(mv);
+        }
+    }
+
+    // Reads the results of previous runs. Each line is "key move score depth", key in hex
+    void readJournal(const std::string &fileName, std::map<uint64_t, searchResult> &results)
+    {
+        std::ifstream journal(fileName);
+        std::string journalLine;
+        while (std::getline(journal, journalLine))
+        {
+            std::istringstream fields(journalLine);
+            searchResult result;
+            if (fields >> std::hex >> result.key >> std::dec >> result.move >> result.score >> result.depth)
+            {
+                auto previous = results.find(result.key);
+                if (previous == results.end() || previous->second.depth <= result.depth)
+                    results[result.key] = result;
+            }
+        }
+    }
+
+    int expandBook(const expandOptions &options)
+    {
+        Book book;
+        if (!book.initialize(options.inputBook))
+            return 1;
+        if (!options.slotDirectory.empty() && !Scheduler::instance().setSlotDirectory(options.slotDirectory))
+        {
+            std::cout << "info string unable to share search slots through " << options.slotDirectory << std::endl;
+            return 1;
+        }
+        std::unordered_map<uint64_t, std::vector<polyBookEntry>> bookIndex;
+        std::vector<polyBookEntry> outputEntries;
+        for (auto entry : book.entries())
+        {
+            polyBookEntry hostEntry{endianSwapU64(entry.key), endianSwapU16(entry.move), endianSwapU16(entry.weight), endianSwapU32(entry.learn)};
+            bookIndex[hostEntry.key].push_back(hostEntry);
+            outputEntries.push_back(hostEntry);
+        }
+
+        // Find the frontier of the book
+        thc::ChessRules cr;
+        std::unordered_set<uint64_t> visited;
+        std::map<uint64_t, std::string> frontier;
+        collectFrontier(cr, zobristHash64Calculate(cr), 0, options, bookIndex, visited, frontier);
+
+        // Skip the positions already searched deep enough in previous runs
+        std::map<uint64_t, searchResult> results;
+        readJournal(options.journal, results);
+        std::vector<frontierPosition> pending;
+        for (auto &position : frontier)
+        {
+            auto done = results.find(position.first);
+            if (done == results.end() || done->second.depth < options.depth)
+                pending.push_back({position.first, position.second});
+        }
+        std::cout << "info string " << frontier.size() << " frontier positions, " << pending.size() << " to search at depth "
+                  << options.depth << " on " << options.threads << " threads" << std::endl;
+
+        // Search them, every thread owns an engine and its hash table
+        std::ofstream journal(options.journal, std::ios::app);
+        std::mutex resultsMutex;
+        std::atomic<size_t> nextPosition{0};
+        size_t searchedPositions{0};
+        auto startTime = std::chrono::steady_clock::now();
+        auto worker = [&]()
+        {
+            std::ostream discardedOutput(nullptr);
+            Engine engine(std::cin, discardedOutput);
+            std::istringstream hashOption("name hashSize value " + std::to_string(options.hashSize));
+            engine.setOption(hashOption);
+            for (size_t i = nextPosition++; i < pending.size(); i = nextPosition++)
+            {
+                thc::Move bestMove;
+                bestMove.src = bestMove.dst = thc::SQUARE_INVALID;
+                int score = engine.searchPosition(pending[i].fen, options.depth, bestMove);
+                if (bestMove.src >= thc::SQUARE_INVALID || bestMove.dst >= thc::SQUARE_INVALID)
+                    continue; // Terminal position, nothing to add to the book
+
+                searchResult result{pending[i].key, moveToPolyMove(bestMove), score, options.depth};
+                std::lock_guard<std::mutex> lock(resultsMutex);
+                results[result.key] = result;
+                journal << std::hex << result.key << std::dec << " " << result.move << " " << result.score << " " << result.depth << std::endl;
+                searchedPositions++;
+                auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - startTime);
+                std::cout << "info string searched " << searchedPositions << "/" << pending.size() << " positions in "
+                          << elapsed.count() << "s, " << bestMove.TerseOut() << " score cp " << score << " in " << pending[i].fen << std::endl;
+            }
+        };
+        std::vector<std::thread> workers;
+        for (unsigned int i = 0; i < options.threads; i++)
+            workers.emplace_back(worker);
+        for (auto &thread : workers)
+            thread.join();
+
+        // Merge the results into the book. Journal entries left over from a different input book are ignored
+        size_t addedEntries{0};
+        for (auto &result : results)
+        {
+            if (!frontier.count(result.first))
+                continue;
+            outputEntries.push_back({result.first, result.second.move, options.weight, 0});
+            addedEntries++;
+        }
+        if (!writeBook(options.outputBook, outputEntries))
+            return 1;
+        std::cout << "info string wrote " << outputEntries.size() << " entries (" << addedEntries << " new) to " << options.outputBook << std::endl;
+        return 0;
+    }
+
+} // end namespace montezuma
+
+int main(int argc, char **argv)
+{
+    montezuma::expandOptions options;
+    if (!montezuma::parseOptions(argc, argv, options))
+    {
+        montezuma::printUsage();
+        return 1;
+    }
+    return montezuma::expandBook(options);
+}
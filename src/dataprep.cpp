@@ -0,0 +1,746 @@
+/*
+ * montezuma_dataprep: removes duplicate positions from training datasets and shuffles them, without holding them in memory.
+ *
+ * Input files are text, one position per line: a FEN or EPD record, followed by any training data (score, result...).
+ * Positions are identified by their Zobrist key, the rest of the line is carried along untouched.
+ *  1. Partition: lines are scattered to shard files by key, so all the copies of a position end up in the same shard.
+ *  2. Dedup: every shard is streamed through a set of the keys seen so far, the first copy of each position
+ *     is scattered to a bucket file chosen at random. When the set of a shard would outgrow its memory, the
+ *     positions not in it yet are split by key into smaller shards, processed in turn.
+ *  3. Shuffle: buckets too large for memory are split at random into smaller ones, then every bucket is shuffled
+ *     in memory and the buckets are concatenated into fixed size chunk files.
+ *     A random bucket followed by a random order inside of it gives a uniform shuffle of the whole dataset.
+ * Each phase runs on all threads, and at most --memory MB are held at any time (besides per-thread overheads).
+ * The number of temporary files open at once stays below MAX_OPEN_FILES, cutting the threads if needed.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include "hashing.h"
+
+namespace montezuma
+{
+
+    struct prepOptions
+    {
+        std::vector<std::string> inputs;
+        std::string outputDir;
+        std::string tempDir;
+        size_t chunkSize{1000000}; // Positions per output chunk
+        unsigned int threads{std::max(1u, std::thread::hardware_concurrency())};
+        size_t memorySize{1024};   // In MB
+    };
+
+    struct inputRange
+    {
+        size_t file;
+        uint64_t begin;
+        uint64_t end;
+    };
+
+    // Sizes derived from the options, see prepareData()
+    struct prepLayout
+    {
+        unsigned int threads;
+        size_t partitions;     // Shard and bucket files written by the first two phases
+        size_t fanOut;         // Files an oversized shard or bucket is split into
+        size_t bufferSize;     // Per-thread write buffers, in bytes
+        size_t maxKeys;        // Distinct positions a thread deduplicates at once
+        uint64_t bucketTarget; // Bucket size shuffled in memory, in bytes
+    };
+
+    const uint64_t INPUT_RANGE_SIZE = 64ULL << 20;  // Input files are split into ranges of this many bytes among threads
+    const size_t MAX_OPEN_FILES = 900;              // Stay below the usual limit of 1024 descriptors
+    const size_t KEY_LENGTH = 17;                   // Shard lines start with the key in hex and a space
+    const size_t KEY_MEMORY = 48;                   // Bytes taken by a key in an unordered_set, bucket array included
+    const unsigned int MAX_SPLIT_LEVEL = 8;         // Buckets still oversized after this many random splits are kept as they are
+
+    void printUsage()
+    {
+        std::cout << "usage: montezuma_dataprep <output dir> <input>... [--chunk positions] [--threads N]"
+                  << " [--memory MB] [--temp dir]\n";
+    }
+
+    bool parseOptions(int argc, char **argv, prepOptions &options)
+    {
+        if (argc < 3)
+            return false;
+        options.outputDir = argv[1];
+        try
+        {
+            for (int i = 2; i < argc; i++)
+            {
+                std::string name = argv[i];
+                if (name.compare(0, 2, "--") != 0)
+                {
+                    options.inputs.push_back(name);
+                    continue;
+                }
+                if (i + 1 >= argc)
+                    return false;
+                std::string value = argv[++i];
+                if (name.compare("--chunk") == 0)
+                    options.chunkSize = std::max(1LL, std::stoll(value));
+                else if (name.compare("--threads") == 0)
+                    options.threads = std::max(1, std::stoi(value));
+                else if (name.compare("--memory") == 0)
+                    options.memorySize = std::max(1LL, std::stoll(value));
+                else if (name.compare("--temp") == 0)
+                    options.tempDir = value;
+                else
+                    return false;
+            }
+        }
+        catch (const std::logic_error &) // Not a number, or out of range
+        {
+            return false;
+        }
+        if (options.tempDir.empty())
+            options.tempDir = options.outputDir + "/tmp";
+        return !options.inputs.empty();
+    }
+
+    // Prints the throughput of a phase every few seconds, and once more when destroyed
+    class progressReporter
+    {
+    public:
+        progressReporter(const std::string &phase, uint64_t totalBytes)
+            : phase_(phase), totalBytes_(totalBytes), startTime_(std::chrono::steady_clock::now()),
+              reporter_([this]()
+                        { run(); }) {}
+
+        ~progressReporter()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                done_ = true;
+            }
+            stop_.notify_all();
+            reporter_.join();
+            report();
+        }
+
+        void add(uint64_t positions, uint64_t bytes)
+        {
+            positions_ += positions;
+            bytes_ += bytes;
+        }
+
+        /* Accounts work found along the way, like the positions of a shard split again */
+        void addTotal(uint64_t bytes) { totalBytes_ += bytes; }
+
+    private:
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (!stop_.wait_for(lock, std::chrono::seconds(2), [this]()
+                                   { return done_; }))
+                report();
+        }
+
+        void report()
+        {
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime_).count();
+            double megaBytes = bytes_ / 1048576.0;
+            std::cout << "info string " << phase_ << ": " << positions_ << " positions, " << std::fixed << std::setprecision(1)
+                      << megaBytes << "/" << totalBytes_ / 1048576.0 << " MB in " << seconds << "s ("
+                      << std::setprecision(0) << positions_ / std::max(seconds, 1e-3) << " positions/s, "
+                      << std::setprecision(1) << megaBytes / std::max(seconds, 1e-3) << " MB/s)" << std::endl;
+        }
+
+        std::string phase_;
+        std::atomic<uint64_t> totalBytes_;
+        std::chrono::steady_clock::time_point startTime_;
+        std::atomic<uint64_t> positions_{0};
+        std::atomic<uint64_t> bytes_{0};
+        std::mutex mutex_;
+        std::condition_variable stop_;
+        bool done_{false};
+        std::thread reporter_;
+    };
+
+    // Temporary files shared by all threads, each with its own lock
+    class partitionFiles
+    {
+    public:
+        partitionFiles(const std::string &prefix, size_t count) : mutexes_(new std::mutex[count])
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                names_.push_back(prefix + std::to_string(i));
+                files_.emplace_back(names_.back(), std::ios::binary | std::ios::trunc);
+            }
+        }
+
+        void write(size_t index, const std::string &data)
+        {
+            std::lock_guard<std::mutex> lock(mutexes_[index]);
+            files_[index].write(data.data(), data.size());
+        }
+
+        /* Flushes and closes the files, returns false if any write failed */
+        bool close()
+        {
+            bool good = true;
+            for (auto &file : files_)
+            {
+                file.close();
+                good = good && !file.fail();
+            }
+            return good;
+        }
+
+        size_t size() const { return names_.size(); }
+        const std::string &name(size_t index) const { return names_[index]; }
+
+    private:
+        std::vector<std::string> names_;
+        std::vector<std::ofstream> files_;
+        std::unique_ptr<std::mutex[]> mutexes_;
+    };
+
+    // Per-thread buffer in front of partitionFiles, so that the locks are taken once per flush rather than per line
+    class partitionBuffer
+    {
+    public:
+        partitionBuffer(partitionFiles &files, size_t capacity) : files_(files), buffers_(files.size()), capacity_(capacity) {}
+        ~partitionBuffer() { flush(); }
+
+        void add(size_t index, std::string_view record)
+        {
+            buffers_[index].append(record);
+            size_ += record.size();
+            if (size_ >= capacity_)
+                flush();
+        }
+
+        /* Same as add, but drops records whose key is already waiting in the buffer, so that the positions
+           repeated most do not bloat the files */
+        void addUnique(size_t index, uint64_t key, std::string_view record)
+        {
+            if (!keys_.insert(key).second)
+                return;
+            size_ += KEY_MEMORY;
+            add(index, record);
+        }
+
+        void flush()
+        {
+            for (size_t i = 0; i < buffers_.size(); i++)
+            {
+                if (buffers_[i].empty())
+                    continue;
+                files_.write(i, buffers_[i]);
+                buffers_[i].clear();
+            }
+            keys_.clear();
+            size_ = 0;
+        }
+
+    private:
+        partitionFiles &files_;
+        std::vector<std::string> buffers_;
+        std::unordered_set<uint64_t> keys_;
+        size_t capacity_;
+        size_t size_{0};
+    };
+
+    // Keys the position of a line from its first four FEN fields; move counters and anything after them are ignored
+    bool positionKey(const std::string &line, thc::ChessRules &cr, uint64_t &key)
+    {
+        std::string fen;
+        size_t fieldEnd = 0;
+        for (int field = 0; field < 4; field++)
+        {
+            size_t fieldStart = line.find_first_not_of(" \t", fieldEnd);
+            if (fieldStart == std::string::npos)
+                return false;
+            fieldEnd = std::min(line.find_first_of(" \t;", fieldStart), line.size());
+            fen.append(line, fieldStart, fieldEnd - fieldStart).push_back(' ');
+        }
+        fen.append("0 1");
+        if (!cr.Forsyth(fen.c_str()))
+            return false;
+        key = zobristHash64Calculate(cr);
+        return true;
+    }
+
+    // Partition of a key among count files at a given split level. Level 0 is the first partitioning, by key modulo
+    // count; the levels below mix the key first, so that the keys sharing a partition get split
+    size_t partitionIndex(uint64_t key, unsigned int level, size_t count)
+    {
+        if (level == 0)
+            return key % count;
+        key += level * 0x9e3779b97f4a7c15ULL; // splitmix64 finalizer
+        key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+        return (key ^ (key >> 31)) % count;
+    }
+
+    bool readFile(const std::string &fileName, std::string &data)
+    {
+        std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+        if (!file)
+            return false;
+        data.resize(file.tellg());
+        file.seekg(0);
+        return static_cast<bool>(file.read(data.data(), data.size()));
+    }
+
+    uint64_t totalSize(const std::vector<std::string> &fileNames)
+    {
+        uint64_t size{0};
+        for (auto &fileName : fileNames)
+            size += std::filesystem::file_size(fileName);
+        return size;
+    }
+
+    std::vector<std::string> partitionNames(const partitionFiles &files)
+    {
+        std::vector<std::string> names;
+        for (size_t i = 0; i < files.size(); i++)
+            names.push_back(files.name(i));
+        return names;
+    }
+
+    // Runs job on every thread and waits for all of them
+    template <typename Job>
+    void runThreads(unsigned int threads, Job job)
+    {
+        std::vector<std::thread> workers;
+        for (unsigned int i = 0; i < threads; i++)
+            workers.emplace_back(job);
+        for (auto &thread : workers)
+            thread.join();
+    }
+
+    // Scatters the input lines to the shards by key
+    bool partitionInputs(const prepOptions &options, const prepLayout &layout, uint64_t inputBytes, partitionFiles &shards,
+                         uint64_t &inputPositions, uint64_t &malformedLines)
+    {
+        std::vector<inputRange> ranges;
+        for (size_t i = 0; i < options.inputs.size(); i++)
+        {
+            uint64_t fileSize = std::filesystem::file_size(options.inputs[i]);
+            for (uint64_t begin = 0; begin < fileSize; begin += INPUT_RANGE_SIZE)
+                ranges.push_back({i, begin, std::min(begin + INPUT_RANGE_SIZE, fileSize)});
+        }
+
+        std::atomic<size_t> nextRange{0};
+        std::atomic<uint64_t> positions{0}, malformed{0};
+        progressReporter progress("partition", inputBytes);
+        runThreads(layout.threads, [&]()
+                   {
+            partitionBuffer buffer(shards, layout.bufferSize);
+            thc::ChessRules cr;
+            std::string line, record;
+            char keyText[KEY_LENGTH + 1];
+            uint64_t localPositions{0}, localBytes{0}, localMalformed{0};
+            for (size_t r = nextRange++; r < ranges.size(); r = nextRange++)
+            {
+                // A range owns the lines starting inside of it, the first partial line belongs to the previous one
+                std::ifstream input(options.inputs[ranges[r].file], std::ios::binary);
+                uint64_t offset = ranges[r].begin;
+                if (offset > 0)
+                {
+                    input.seekg(offset - 1);
+                    std::getline(input, line);
+                    offset += line.size();
+                }
+                while (offset < ranges[r].end && std::getline(input, line))
+                {
+                    offset += line.size() + 1;
+                    localBytes += line.size() + 1;
+                    if (!line.empty() && line.back() == '\r')
+                        line.pop_back();
+                    uint64_t key;
+                    if (line.find_first_not_of(" \t") == std::string::npos)
+                        continue;
+                    if (!positionKey(line, cr, key))
+                    {
+                        localMalformed++;
+                        continue;
+                    }
+                    snprintf(keyText, sizeof(keyText), "%016llx ", static_cast<unsigned long long>(key));
+                    record.assign(keyText).append(line).push_back('\n');
+                    buffer.addUnique(partitionIndex(key, 0, shards.size()), key, record);
+                    if (++localPositions % 4096 == 0)
+                    {
+                        progress.add(4096, localBytes);
+                        localBytes = 0;
+                    }
+                }
+            }
+            progress.add(localPositions % 4096, localBytes);
+            positions += localPositions;
+            malformed += localMalformed; });
+
+        inputPositions = positions;
+        malformedLines = malformed;
+        return shards.close();
+    }
+
+    struct shardFile
+    {
+        std::string name;
+        unsigned int level; // Times the positions of the shard have been partitioned
+    };
+
+    // Keeps the first copy of every position of each shard, and scatters it to a random bucket. Only the keys are
+    // kept in memory: once a thread holds layout.maxKeys of them, the positions of the shard not seen yet are
+    // partitioned again into smaller shards, which are deduplicated in turn
+    bool dedupShards(const prepLayout &layout, const partitionFiles &shards, partitionFiles &buckets, uint64_t &uniquePositions)
+    {
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::deque<shardFile> pending;
+        unsigned int busy{0};
+        bool good{true};
+        for (size_t i = 0; i < shards.size(); i++)
+            pending.push_back({shards.name(i), 0});
+        std::atomic<uint64_t> unique{0};
+        progressReporter progress("dedup", totalSize(partitionNames(shards)));
+        runThreads(layout.threads, [&]()
+                   {
+            partitionBuffer buffer(buckets, layout.bufferSize);
+            std::mt19937_64 rng(std::random_device{}() ^ (static_cast<uint64_t>(std::random_device{}()) << 32));
+            std::unordered_set<uint64_t> seen;
+            std::string line;
+            while (true)
+            {
+                shardFile shard;
+                {
+                    // Wait while the shards still being processed may be split into new ones
+                    std::unique_lock<std::mutex> lock(mutex);
+                    changed.wait(lock, [&]()
+                                 { return !pending.empty() || busy == 0; });
+                    if (pending.empty())
+                        return;
+                    shard = pending.front();
+                    pending.pop_front();
+                    busy++;
+                }
+                std::ifstream input(shard.name, std::ios::binary);
+                bool shardGood = static_cast<bool>(input);
+                std::unique_ptr<partitionFiles> splits;
+                std::unique_ptr<partitionBuffer> splitBuffer;
+                seen.clear();
+                uint64_t positions{0}, bytes{0}, localUnique{0};
+                while (std::getline(input, line))
+                {
+                    bytes += line.size() + 1;
+                    if (line.size() < KEY_LENGTH)
+                        continue;
+                    positions++;
+                    uint64_t key = std::strtoull(line.c_str(), nullptr, 16);
+                    if (seen.count(key))
+                        continue;
+                    line.push_back('\n');
+                    if (seen.size() < layout.maxKeys)
+                    {
+                        seen.insert(key);
+                        buffer.add(rng() % buckets.size(), std::string_view(line).substr(KEY_LENGTH));
+                        localUnique++;
+                        continue;
+                    }
+                    if (!splits)
+                    {
+                        splits = std::make_unique<partitionFiles>(shard.name + ".", layout.fanOut);
+                        splitBuffer = std::make_unique<partitionBuffer>(*splits, layout.bufferSize);
+                    }
+                    splitBuffer->addUnique(partitionIndex(key, shard.level + 1, layout.fanOut), key, line);
+                }
+                input.close();
+                std::filesystem::remove(shard.name);
+                progress.add(positions, bytes);
+                unique += localUnique;
+
+                std::vector<shardFile> children;
+                if (splits)
+                {
+                    splitBuffer.reset();
+                    shardGood = splits->close() && shardGood;
+                    for (size_t i = 0; i < splits->size(); i++)
+                        children.push_back({splits->name(i), shard.level + 1});
+                    progress.addTotal(totalSize(partitionNames(*splits)));
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                pending.insert(pending.end(), children.begin(), children.end());
+                good = good && shardGood;
+                busy--;
+                changed.notify_all();
+            } });
+
+        uniquePositions = unique;
+        return buckets.close() && good;
+    }
+
+    // Splits a bucket too large to be shuffled in memory into random smaller ones, appended in order to names
+    bool splitBucket(const prepLayout &layout, const std::string &bucketName, unsigned int level, std::mt19937_64 &rng,
+                     std::vector<std::string> &names)
+    {
+        uint64_t size = std::filesystem::file_size(bucketName);
+        if (size <= 2 * layout.bucketTarget || level >= MAX_SPLIT_LEVEL)
+        {
+            names.push_back(bucketName);
+            return true;
+        }
+        size_t count = std::min<uint64_t>(layout.fanOut, size / layout.bucketTarget + 1);
+        partitionFiles parts(bucketName + ".", count);
+        {
+            partitionBuffer buffer(parts, layout.bufferSize);
+            std::ifstream input(bucketName, std::ios::binary);
+            std::string line;
+            while (std::getline(input, line))
+            {
+                line.push_back('\n');
+                buffer.add(rng() % count, line);
+            }
+        }
+        if (!parts.close())
+            return false;
+        std::filesystem::remove(bucketName);
+        for (size_t i = 0; i < count; i++)
+            if (!splitBucket(layout, parts.name(i), level + 1, rng, names))
+                return false;
+        return true;
+    }
+
+    bool splitBuckets(const prepLayout &layout, const partitionFiles &buckets, std::vector<std::string> &names)
+    {
+        std::vector<std::vector<std::string>> parts(buckets.size());
+        std::atomic<size_t> nextBucket{0};
+        std::atomic<bool> good{true};
+        runThreads(layout.threads, [&]()
+                   {
+            std::mt19937_64 rng(std::random_device{}() ^ (static_cast<uint64_t>(std::random_device{}()) << 32));
+            for (size_t b = nextBucket++; b < buckets.size(); b = nextBucket++)
+                if (!splitBucket(layout, buckets.name(b), 0, rng, parts[b]))
+                    good = false; });
+        for (auto &bucketParts : parts)
+            names.insert(names.end(), bucketParts.begin(), bucketParts.end());
+        return good;
+    }
+
+    // Writes positions to numbered chunk files of options.chunkSize lines each
+    class chunkWriter
+    {
+    public:
+        chunkWriter(const std::string &outputDir, size_t chunkSize) : outputDir_(outputDir), chunkSize_(chunkSize) {}
+
+        bool write(std::string_view line)
+        {
+            if (linesInChunk_ == 0 || linesInChunk_ == chunkSize_)
+            {
+                if (!closeChunk())
+                    return false;
+                std::ostringstream name;
+                name << outputDir_ << "/chunk-" << std::setw(5) << std::setfill('0') << chunks_++ << ".txt";
+                chunk_.open(name.str(), std::ios::binary | std::ios::trunc);
+                linesInChunk_ = 0;
+            }
+            chunk_.write(line.data(), line.size());
+            linesInChunk_++;
+            return !chunk_.fail();
+        }
+
+        bool closeChunk()
+        {
+            if (!chunk_.is_open())
+                return true;
+            chunk_.close();
+            return !chunk_.fail();
+        }
+
+        size_t chunks() const { return chunks_; }
+
+    private:
+        std::string outputDir_;
+        size_t chunkSize_;
+        std::ofstream chunk_;
+        size_t linesInChunk_{0};
+        size_t chunks_{0};
+    };
+
+    struct shuffledBucket
+    {
+        std::string data;
+        std::vector<std::string_view> lines;
+    };
+
+    // Shuffles the buckets on the worker threads, while this thread writes them out in order
+    bool shuffleBuckets(const prepOptions &options, const prepLayout &layout, const std::vector<std::string> &buckets, size_t &chunks)
+    {
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::map<size_t, shuffledBucket> ready;
+        size_t nextBucket{0}, nextToWrite{0};
+        bool good{true};
+        progressReporter progress("shuffle", totalSize(buckets));
+
+        std::vector<std::thread> workers;
+        for (unsigned int i = 0; i < layout.threads; i++)
+            workers.emplace_back([&]()
+                                 {
+            std::mt19937_64 rng(std::random_device{}() ^ (static_cast<uint64_t>(std::random_device{}()) << 32));
+            while (true)
+            {
+                size_t b;
+                {
+                    // Loaded buckets wait for the writer, never hold more than one per thread
+                    std::unique_lock<std::mutex> lock(mutex);
+                    changed.wait(lock, [&]()
+                                 { return nextBucket < nextToWrite + layout.threads || !good; });
+                    if (nextBucket >= buckets.size() || !good)
+                        return;
+                    b = nextBucket++;
+                }
+                shuffledBucket bucket;
+                bool loaded = readFile(buckets[b], bucket.data);
+                std::filesystem::remove(buckets[b]);
+                for (size_t start = 0, end; start < bucket.data.size(); start = end + 1)
+                {
+                    end = bucket.data.find('\n', start);
+                    if (end == std::string::npos)
+                        break;
+                    bucket.lines.emplace_back(bucket.data.data() + start, end + 1 - start);
+                }
+                std::shuffle(bucket.lines.begin(), bucket.lines.end(), rng);
+                std::lock_guard<std::mutex> lock(mutex);
+                good = good && loaded;
+                ready[b] = std::move(bucket);
+                changed.notify_all();
+            } });
+
+        chunkWriter writer(options.outputDir, options.chunkSize);
+        for (size_t b = 0; b < buckets.size(); b++)
+        {
+            shuffledBucket bucket;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&]()
+                             { return ready.count(b) || !good; });
+                if (!good)
+                    break;
+                bucket = std::move(ready[b]);
+                ready.erase(b);
+                nextToWrite = b + 1; // Lets another bucket load while this one is written
+                changed.notify_all();
+            }
+            bool written = true;
+            for (auto line : bucket.lines)
+                written = written && writer.write(line);
+            progress.add(bucket.lines.size(), bucket.data.size());
+            if (!written)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                good = false;
+                changed.notify_all();
+                break;
+            }
+        }
+        for (auto &thread : workers)
+            thread.join();
+        chunks = writer.chunks();
+        return writer.closeChunk() && good;
+    }
+
+    int prepareData(const prepOptions &options)
+    {
+        auto startTime = std::chrono::steady_clock::now();
+        uint64_t inputBytes;
+        try
+        {
+            std::filesystem::create_directories(options.outputDir);
+            std::filesystem::create_directories(options.tempDir);
+            inputBytes = totalSize(options.inputs);
+        }
+        catch (const std::filesystem::filesystem_error &error)
+        {
+            std::cout << "info string " << error.what() << std::endl;
+            return 1;
+        }
+
+        // Every thread gets an equal share of the memory: half of it for the keys it deduplicates, or for the
+        // bucket it shuffles while another one waits for the writer, a quarter for each of its write buffers
+        prepLayout layout;
+        layout.threads = options.threads;
+        if (layout.threads > MAX_OPEN_FILES / 6)
+        {
+            layout.threads = MAX_OPEN_FILES / 6;
+            std::cout << "info string using " << layout.threads << " threads to keep the temporary files open below " << MAX_OPEN_FILES << std::endl;
+        }
+        size_t threadMemory = (options.memorySize << 20) / layout.threads;
+        layout.bufferSize = std::max<size_t>(threadMemory / 4, 1);
+        layout.maxKeys = std::max<size_t>(threadMemory / 2 / KEY_MEMORY, 1);
+        layout.bucketTarget = std::max<uint64_t>(threadMemory / 8, 1);
+        // Oversized shards and buckets are split again, so the partitions only need to fit the descriptors: each thread
+        // may read a shard and split it while all the buckets are open
+        layout.partitions = std::clamp<uint64_t>(inputBytes / layout.bucketTarget + 1, layout.threads, MAX_OPEN_FILES / 2);
+        layout.fanOut = std::max<size_t>(2, MAX_OPEN_FILES / 2 / layout.threads - 1);
+        std::cout << "info string " << options.inputs.size() << " input files, " << inputBytes / 1048576 << " MB, "
+                  << layout.partitions << " partitions on " << layout.threads << " threads" << std::endl;
+
+        uint64_t inputPositions, malformedLines, uniquePositions;
+        size_t chunks;
+        std::string tempPrefix = options.tempDir + "/";
+        {
+            partitionFiles shards(tempPrefix + "shard-", layout.partitions);
+            if (!partitionInputs(options, layout, inputBytes, shards, inputPositions, malformedLines))
+            {
+                std::cout << "info string could not write the shards to " << options.tempDir << std::endl;
+                return 1;
+            }
+            partitionFiles buckets(tempPrefix + "bucket-", layout.partitions);
+            std::vector<std::string> bucketNames;
+            if (!dedupShards(layout, shards, buckets, uniquePositions) || !splitBuckets(layout, buckets, bucketNames))
+            {
+                std::cout << "info string could not write the buckets to " << options.tempDir << std::endl;
+                return 1;
+            }
+            if (!shuffleBuckets(options, layout, bucketNames, chunks))
+            {
+                std::cout << "info string could not write the chunks to " << options.outputDir << std::endl;
+                return 1;
+            }
+        }
+        std::error_code ignored;
+        std::filesystem::remove(options.tempDir, ignored); // Only if empty, the user may have pointed us to a shared directory
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - startTime);
+        std::cout << "info string wrote " << uniquePositions << " positions to " << chunks << " chunks in " << options.outputDir
+                  << " in " << elapsed.count() << "s, " << inputPositions - uniquePositions << " duplicates removed, "
+                  << malformedLines << " malformed lines skipped" << std::endl;
+        return 0;
+    }
+
+} // end namespace montezuma
+
+int main(int argc, char **argv)
+{
+    montezuma::prepOptions options;
+    if (!montezuma::parseOptions(argc, argv, options))
+    {
+        montezuma::printUsage();
+        return 1;
+    }
+    return montezuma::prepareData(options);
+}
@@ -18,6 +18,8 @@ namespace montezuma
         while (true)
         {
             inputStream_ >> command;
+            auto received = std::chrono::steady_clock::now();
+            Command commandKind = commandFromName(command);
             outputStream_ << "info string " << command << std::endl;
             if (command.compare("uci") == 0)
             {
@@ -57,12 +59,14 @@ namespace montezuma
             else if (command.find("go", 0) == 0)
             {
                 std::getline(inputStream_, command);
-                inputGo(command);
+                inputGo(command, received);
             }
             else if (command.find("quit", 0) == 0)
             {
                 break;
             }
+            if (commandKind != Command::GO) // Searches account for their latency when they answer
+                Metrics::instance().recordCommand(commandKind, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - received));
         }
         return 0;
     }
@@ -74,6 +78,11 @@ namespace montezuma
                       << "option name hashSize type spin default 64 min 1 max 128\n"
                       << "option name bookPath type string\n"
                       << "option name maxSearchDepth type spin default 6 min 1 max 10\n"
+                      << "option name searchSlots type spin default " << Scheduler::instance().slots() << " min 1 max 1024\n"
+                      << "option name searchClass type combo default auto var auto var interactive var batch\n"
+                      << "option name slotDir type string\n"
+                      << "option name metricsPath type string\n"
+                      << "option name metricsInterval type spin default 10 min 1 max 3600\n"
                       << "uciok\n";
     }
 
@@ -146,13 +155,27 @@ namespace montezuma
     }
 
     // Start move evaluation
-    void Engine::inputGo(const std::string command)
+    void Engine::inputGo(const std::string command, std::chrono::steady_clock::time_point received)
     {
-        std::thread searchThread(&Engine::startSearching, this, command);
+        std::thread searchThread(&Engine::startSearching, this, command, received);
         searchThread.detach();
     }
 
-    void Engine::startSearching(const std::string command)
+    int Engine::searchPosition(const std::string &fen, unsigned int depth, thc::Move &bestMove)
+    {
+        if (hashTable_.empty())
+            initHashTable();
+        updatePosition(" fen " + fen);
+        usingTime_ = false;
+        globalPvLine_.moveCount = 0;
+        selectSearchClass();
+        int bestScore = iterativeDeepening(depth);
+        if (globalPvLine_.moveCount > 0)
+            bestMove = globalPvLine_.moves[0];
+        return bestScore;
+    }
+
+    void Engine::startSearching(const std::string command, std::chrono::steady_clock::time_point received)
     {
         // Save available time
         unsigned int maxSearchDepth = maxSearchDepth_;
@@ -182,28 +205,52 @@ namespace montezuma
         // Search
         // If the position is in the opening book, use it
         char *bestMove = (char *)malloc(6 * sizeof(char));
-        if (isOpening_ && book_.getMove(cr_, currentHash_, bestMove))
+        bool bookMove = isOpening_ && book_.getMove(cr_, currentHash_, bestMove);
+        if (isOpening_)
+            Metrics::instance().recordBookProbe(bookMove);
+        if (bookMove)
         {
             outputStream_ << "bestmove " << bestMove << std::endl;
+            Metrics::instance().recordCommand(Command::GO, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - received));
             return;
         }
         else // Otherwise stop looking in the book
             isOpening_ = false;
         free(bestMove);
 
+        selectSearchClass();
+        iterativeDeepening(maxSearchDepth);
+
+        outputStream_ << "bestmove " << globalPvLine_.moves[0].TerseOut() << std::endl;
+        outputStream_.flush();
+        Metrics::instance().recordCommand(Command::GO, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - received));
+    }
+
+    int Engine::iterativeDeepening(unsigned int maxSearchDepth)
+    {
         line pvLine;
-        usingPreviousLine_ = false;
+        int bestScore{0};
+        unsigned long long searchNodes{0};
+        Scheduler &scheduler = Scheduler::instance();
+        // The clock runs while waiting for a slot too, a clocked search must still answer in time
         startTimeSearch_ = std::chrono::high_resolution_clock::now();
+        scheduler.acquire(searchClass_);
+        nodesSinceCheckpoint_ = 0;
+        usingPreviousLine_ = false;
         for (int incrementalDepth = 1; incrementalDepth <= maxSearchDepth; incrementalDepth++)
         {
+            scheduler.checkpoint(searchClass_);
             evaluatedPositions_ = 0;
+            tableProbes_ = tableHits_ = 0;
+            suspendedTime_ = std::chrono::microseconds(0);
             auto startTimeThisDepth = std::chrono::high_resolution_clock::now();
-            int bestScore = alphaBeta(-MATE_SCORE, MATE_SCORE, incrementalDepth, &pvLine, incrementalDepth); // to avoid overflow when changing sign in recursive calls, do not use INT_MIN as either alpha or beta
+            bestScore = alphaBeta(-MATE_SCORE, MATE_SCORE, incrementalDepth, &pvLine, incrementalDepth); // to avoid overflow when changing sign in recursive calls, do not use INT_MIN as either alpha or beta
             globalPvLine_.moveCount = 0;
             retrievePvLineFromTable(&globalPvLine_);
 
             auto stopTime = std::chrono::high_resolution_clock::now();
-            auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(stopTime - startTimeThisDepth);
+            // Only the time actually spent searching, for the speed to be right when the search was suspended
+            auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(stopTime - startTimeThisDepth - suspendedTime_);
             auto nps = (duration.count() > 0) ? 1000 * evaluatedPositions_ / duration.count() : 0;
             // Check if the returned score signifies a mate and in how many moves
             if (MATE_SCORE - abs(bestScore) < 100)
@@ -222,6 +269,8 @@ namespace montezuma
             }
             outputStream_ << std::endl;
             usingPreviousLine_ = true;
+            searchNodes += evaluatedPositions_;
+            Metrics::instance().addSearchWork(searchClass_, evaluatedPositions_, std::chrono::duration_cast<std::chrono::microseconds>(duration), tableProbes_, tableHits_);
 
             // Check if time is up
             stopTime = std::chrono::high_resolution_clock::now();
@@ -229,13 +278,30 @@ namespace montezuma
             if (usingTime_ && searchDuration.count() > limitTime_)
                 break;
         }
+        scheduler.release(searchClass_);
+        scheduler.recordSearch(searchClass_, searchNodes);
+        auto searchDuration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - startTimeSearch_);
+        Metrics::instance().recordSearch(searchClass_, searchDuration, usingTime_ ? limitTime_ : 0);
+        return bestScore;
+    }
 
-        outputStream_ << "bestmove " << globalPvLine_.moves[0].TerseOut() << std::endl;
-        outputStream_.flush();
+    void Engine::selectSearchClass()
+    {
+        if (searchClassOption_.compare("interactive") == 0)
+            searchClass_ = SearchClass::INTERACTIVE;
+        else if (searchClassOption_.compare("batch") == 0)
+            searchClass_ = SearchClass::BATCH;
+        else // Clocked searches have someone waiting for the answer
+            searchClass_ = usingTime_ ? SearchClass::INTERACTIVE : SearchClass::BATCH;
     }
 
     int Engine::alphaBeta(int alpha, int beta, int depth, line *pvLine, int initialDepth)
     {
+        if (++nodesSinceCheckpoint_ >= CHECKPOINT_NODES)
+        { // Let the scheduler suspend this search if the slot is needed elsewhere
+            nodesSinceCheckpoint_ = 0;
+            suspendedTime_ += Scheduler::instance().checkpoint(searchClass_);
+        }
         int score;
         if (probeHash(depth, alpha, beta, score))
             return score;
@@ -247,7 +313,8 @@ namespace montezuma
         auto stopTime = std::chrono::high_resolution_clock::now();
         auto searchDuration = std::chrono::duration_cast<std::chrono::milliseconds>(stopTime - startTimeSearch_);
 
-        if (depth == 0 || legalMoves.size() == 0 || (usingTime_ && searchDuration.count() > limitTime_))
+        // The first iteration always completes, so that there is a move to answer even if the slot came late
+        if (depth == 0 || legalMoves.size() == 0 || (usingTime_ && initialDepth > 1 && searchDuration.count() > limitTime_))
         {
             pvLine->moveCount = 0;
             score = evaluate();
@@ -366,8 +433,10 @@ namespace montezuma
     {
 
         hashEntry *entry = &hashTable_[currentHash_ % numPositions_];
+        tableProbes_++;
         if (entry->key == currentHash_)
         { // Check that the key is the same (not a type ? collision)
+            tableHits_++;
             if (entry->depth >= depth)
             { // If it was already searched at a depth greater than the one requested now
                 if (entry->repetitionCount >= 2)
@@ -442,7 +511,7 @@ namespace montezuma
         std::string optionName, optionValue;
         commandStream >> optionName >> optionName; // Throw away the "name" and "value" keys
         commandStream >> optionValue >> optionValue;
-        std::cout << "info string setting " << optionName << " to " << optionValue << std::endl;
+        outputStream_ << "info string setting " << optionName << " to " << optionValue << std::endl;
 
         if (optionName.compare("bookPath") == 0)
         {
@@ -457,6 +526,27 @@ namespace montezuma
             hashTableSize_ = std::stoi(optionValue);
             initHashTable();
         }
+        else if (optionName.compare("searchSlots") == 0)
+        {
+            Scheduler::instance().setSlots(std::stoi(optionValue));
+        }
+        else if (optionName.compare("searchClass") == 0)
+        {
+            searchClassOption_ = optionValue;
+        }
+        else if (optionName.compare("slotDir") == 0)
+        {
+            if (!Scheduler::instance().setSlotDirectory(optionValue.compare("<empty>") == 0 ? "" : optionValue))
+                outputStream_ << "info string unable to share search slots through " << optionValue << std::endl;
+        }
+        else if (optionName.compare("metricsPath") == 0)
+        {
+            Metrics::instance().setExportTarget(optionValue);
+        }
+        else if (optionName.compare("metricsInterval") == 0)
+        {
+            Metrics::instance().setExportInterval(std::stoi(optionValue));
+        }
     }
 
     void Engine::debug()
@@ -468,6 +558,14 @@ namespace montezuma
         outputStream_ << "Entry at " << currentHash_ % numPositions_ << ": ";
         printf("depth:%d, flag:%d, score:%d, repetitions:%u, bestMove:", entry->depth, static_cast<int>(entry->flag), entry->score, entry->repetitionCount);
         outputStream_ << entry->bestMove.TerseOut() << std::endl;
+        const char *classNames[2] = {"interactive", "batch"};
+        for (auto searchClass : {SearchClass::INTERACTIVE, SearchClass::BATCH})
+        {
+            schedulerStats stats = Scheduler::instance().stats(searchClass);
+            outputStream_ << "Scheduler " << classNames[static_cast<int>(searchClass)] << ": searches " << stats.searches
+                          << ", nodes " << stats.nodes << ", preemptions " << stats.preemptions
+                          << ", wait " << stats.waitMs << "ms (max " << stats.maxWaitMs << "ms), run " << stats.runMs << "ms" << std::endl;
+        }
     }
 
 } // end namespace montezuma
\ No newline at end of file
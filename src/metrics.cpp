@@ -0,0 +1,357 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include "metrics.h"
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace montezuma
+{
+
+    static const char *classNames[2] = {"interactive", "batch"};
+    static const char *commandNames[static_cast<int>(Command::COUNT)] = {"uci", "isready", "ucinewgame", "setoption", "position", "go", "other"};
+
+    Command commandFromName(const std::string &name)
+    {
+        for (int i = 0; i < static_cast<int>(Command::OTHER); i++)
+            if (name.compare(commandNames[i]) == 0)
+                return static_cast<Command>(i);
+        return Command::OTHER;
+    }
+
+    // Counters have a single writer, a plain load and store is enough and avoids locked instructions
+    static void bump(std::atomic<uint64_t> &counter, uint64_t value)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    void threadCounters::addTo(metricsSnapshot &snapshot) const
+    {
+        for (int c = 0; c < 2; c++)
+        {
+            snapshot.searches[c] += searches[c].load(std::memory_order_relaxed);
+            snapshot.nodes[c] += nodes[c].load(std::memory_order_relaxed);
+            snapshot.searchMicros[c] += searchMicros[c].load(std::memory_order_relaxed);
+        }
+        snapshot.ttProbes += ttProbes.load(std::memory_order_relaxed);
+        snapshot.ttHits += ttHits.load(std::memory_order_relaxed);
+        snapshot.bookProbes += bookProbes.load(std::memory_order_relaxed);
+        snapshot.bookHits += bookHits.load(std::memory_order_relaxed);
+        snapshot.timedSearches += timedSearches.load(std::memory_order_relaxed);
+        snapshot.overruns += overruns.load(std::memory_order_relaxed);
+        for (int command = 0; command < static_cast<int>(Command::COUNT); command++)
+        {
+            for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+                snapshot.latency[command][bucket] += latency[command][bucket].load(std::memory_order_relaxed);
+            snapshot.latencyMicros[command] += latencyMicros[command].load(std::memory_order_relaxed);
+        }
+    }
+
+    // Owns the counters of a thread for as long as the thread lives
+    struct threadSlot
+    {
+        threadSlot()
+        {
+            Metrics &metrics = Metrics::instance();
+            std::lock_guard<std::mutex> lock(metrics.registryMutex_);
+            metrics.liveCounters_.push_back(&counters);
+        }
+        ~threadSlot() { Metrics::instance().unregister(&counters); }
+
+        threadCounters counters;
+    };
+
+    Metrics &Metrics::instance()
+    {
+        static Metrics metrics;
+        return metrics;
+    }
+
+    Metrics::~Metrics()
+    {
+        stopExport();
+    }
+
+    threadCounters &Metrics::local()
+    {
+        static thread_local threadSlot slot;
+        return slot.counters;
+    }
+
+    void Metrics::unregister(threadCounters *counters)
+    {
+        std::lock_guard<std::mutex> lock(registryMutex_);
+        counters->addTo(retired_);
+        liveCounters_.erase(std::find(liveCounters_.begin(), liveCounters_.end(), counters));
+    }
+
+    void Metrics::addSearchWork(SearchClass searchClass, uint64_t nodes, std::chrono::microseconds duration, uint64_t ttProbes, uint64_t ttHits)
+    {
+        threadCounters &counters = local();
+        bump(counters.nodes[static_cast<int>(searchClass)], nodes);
+        bump(counters.searchMicros[static_cast<int>(searchClass)], duration.count());
+        bump(counters.ttProbes, ttProbes);
+        bump(counters.ttHits, ttHits);
+    }
+
+    void Metrics::recordSearch(SearchClass searchClass, std::chrono::microseconds duration, unsigned long allocatedMs)
+    {
+        threadCounters &counters = local();
+        bump(counters.searches[static_cast<int>(searchClass)], 1);
+        if (allocatedMs == 0)
+            return;
+        bump(counters.timedSearches, 1);
+        if (duration > std::chrono::milliseconds(allocatedMs + OVERRUN_MARGIN_MS))
+            bump(counters.overruns, 1);
+    }
+
+    void Metrics::recordBookProbe(bool hit)
+    {
+        threadCounters &counters = local();
+        bump(counters.bookProbes, 1);
+        if (hit)
+            bump(counters.bookHits, 1);
+    }
+
+    // Latencies below 2 * LATENCY_SUB_BUCKETS microseconds get a bucket each, every power of two above is split
+    // into LATENCY_SUB_BUCKETS buckets of equal width, so a bucket is never wider than 1/LATENCY_SUB_BUCKETS of its values
+    static int latencyBucket(uint64_t micros)
+    {
+        if (micros < 2 * LATENCY_SUB_BUCKETS)
+            return static_cast<int>(micros);
+        int shift = 0; // micros >> shift lies in [LATENCY_SUB_BUCKETS, 2 * LATENCY_SUB_BUCKETS)
+        while ((micros >> shift) >= 2 * LATENCY_SUB_BUCKETS)
+            shift++;
+        return std::min<int>(LATENCY_BUCKETS - 1, (shift + 1) * LATENCY_SUB_BUCKETS + static_cast<int>(micros >> shift) - LATENCY_SUB_BUCKETS);
+    }
+
+    // Smallest latency of a bucket, in microseconds
+    static double bucketLowerBound(int bucket)
+    {
+        if (bucket < 2 * LATENCY_SUB_BUCKETS)
+            return bucket;
+        int shift = bucket / LATENCY_SUB_BUCKETS - 1;
+        return std::ldexp(LATENCY_SUB_BUCKETS + bucket % LATENCY_SUB_BUCKETS, shift);
+    }
+
+    void Metrics::recordCommand(Command command, std::chrono::microseconds latency)
+    {
+        threadCounters &counters = local();
+        uint64_t micros = std::max<int64_t>(latency.count(), 0);
+        bump(counters.latency[static_cast<int>(command)][latencyBucket(micros)], 1);
+        bump(counters.latencyMicros[static_cast<int>(command)], micros);
+    }
+
+    metricsSnapshot Metrics::snapshot() const
+    {
+        std::lock_guard<std::mutex> lock(registryMutex_);
+        metricsSnapshot snapshot = retired_;
+        for (auto counters : liveCounters_)
+            counters->addTo(snapshot);
+        return snapshot;
+    }
+
+    // Latency of the given quantile in seconds, interpolated inside of its bucket as if the latencies there were spread evenly
+    static double latencyQuantile(const uint64_t *buckets, uint64_t count, double quantile)
+    {
+        uint64_t rank = std::max<uint64_t>(1, std::ceil(quantile * count));
+        uint64_t seen = 0;
+        int bucket = 0;
+        for (; bucket < LATENCY_BUCKETS - 1; bucket++)
+        {
+            if (seen + buckets[bucket] >= rank)
+                break;
+            seen += buckets[bucket];
+        }
+        if (buckets[bucket] == 0)
+            return bucketLowerBound(bucket) / 1e6;
+        double lower = bucketLowerBound(bucket), upper = bucketLowerBound(bucket + 1);
+        double position = (rank - seen - 0.5) / buckets[bucket];
+        return (lower + position * (upper - lower)) / 1e6;
+    }
+
+    static void writeHeader(std::ostringstream &text, const std::string &name, const std::string &type, const std::string &help)
+    {
+        text << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n";
+    }
+
+    std::string Metrics::prometheusText()
+    {
+        metricsSnapshot s = snapshot();
+        std::ostringstream text;
+        text.precision(15);
+
+        writeHeader(text, "montezuma_searches_total", "counter", "Completed searches.");
+        for (int c = 0; c < 2; c++)
+            text << "montezuma_searches_total{class=\"" << classNames[c] << "\"} " << s.searches[c] << "\n";
+        writeHeader(text, "montezuma_nodes_total", "counter", "Positions evaluated by the searches.");
+        for (int c = 0; c < 2; c++)
+            text << "montezuma_nodes_total{class=\"" << classNames[c] << "\"} " << s.nodes[c] << "\n";
+        writeHeader(text, "montezuma_search_seconds_total", "counter", "Time spent searching.");
+        for (int c = 0; c < 2; c++)
+            text << "montezuma_search_seconds_total{class=\"" << classNames[c] << "\"} " << s.searchMicros[c] / 1e6 << "\n";
+
+        // Speed of the search iterations completed since the previous export
+        uint64_t nodes = s.nodes[0] + s.nodes[1];
+        uint64_t searchMicros = s.searchMicros[0] + s.searchMicros[1];
+        double nps;
+        {
+            std::lock_guard<std::mutex> lock(registryMutex_);
+            nps = searchMicros > lastSearchMicros_ ? (nodes - lastNodes_) * 1e6 / (searchMicros - lastSearchMicros_) : 0;
+            lastNodes_ = nodes;
+            lastSearchMicros_ = searchMicros;
+        }
+        writeHeader(text, "montezuma_nps", "gauge", "Nodes per second of searching since the previous export.");
+        text << "montezuma_nps " << nps << "\n";
+
+        schedulerStats scheduler[2] = {Scheduler::instance().stats(SearchClass::INTERACTIVE), Scheduler::instance().stats(SearchClass::BATCH)};
+        writeHeader(text, "montezuma_scheduler_preemptions_total", "counter", "Times a running search gave its slot away.");
+        for (int c = 0; c < 2; c++)
+            text << "montezuma_scheduler_preemptions_total{class=\"" << classNames[c] << "\"} " << scheduler[c].preemptions << "\n";
+        writeHeader(text, "montezuma_scheduler_wait_seconds_total", "counter", "Time spent waiting for a search slot.");
+        for (int c = 0; c < 2; c++)
+            text << "montezuma_scheduler_wait_seconds_total{class=\"" << classNames[c] << "\"} " << scheduler[c].waitMs / 1e3 << "\n";
+        writeHeader(text, "montezuma_scheduler_max_wait_seconds", "gauge", "Longest single wait for a search slot.");
+        for (int c = 0; c < 2; c++)
+            text << "montezuma_scheduler_max_wait_seconds{class=\"" << classNames[c] << "\"} " << scheduler[c].maxWaitMs / 1e3 << "\n";
+        writeHeader(text, "montezuma_scheduler_run_seconds_total", "counter", "Time spent holding a search slot.");
+        for (int c = 0; c < 2; c++)
+            text << "montezuma_scheduler_run_seconds_total{class=\"" << classNames[c] << "\"} " << scheduler[c].runMs / 1e3 << "\n";
+
+        writeHeader(text, "montezuma_tt_probes_total", "counter", "Transposition table probes.");
+        text << "montezuma_tt_probes_total " << s.ttProbes << "\n";
+        writeHeader(text, "montezuma_tt_hits_total", "counter", "Transposition table probes finding their position.");
+        text << "montezuma_tt_hits_total " << s.ttHits << "\n";
+        writeHeader(text, "montezuma_tt_hit_ratio", "gauge", "Share of the transposition table probes finding their position.");
+        text << "montezuma_tt_hit_ratio " << (s.ttProbes ? static_cast<double>(s.ttHits) / s.ttProbes : 0) << "\n";
+        writeHeader(text, "montezuma_book_probes_total", "counter", "Opening book lookups.");
+        text << "montezuma_book_probes_total " << s.bookProbes << "\n";
+        writeHeader(text, "montezuma_book_hits_total", "counter", "Moves played from the opening book.");
+        text << "montezuma_book_hits_total " << s.bookHits << "\n";
+        writeHeader(text, "montezuma_timed_searches_total", "counter", "Completed searches on the clock.");
+        text << "montezuma_timed_searches_total " << s.timedSearches << "\n";
+        writeHeader(text, "montezuma_time_overruns_total", "counter", "Searches on the clock answering more than " + std::to_string(OVERRUN_MARGIN_MS) + "ms after their time allocation.");
+        text << "montezuma_time_overruns_total " << s.overruns << "\n";
+
+        writeHeader(text, "montezuma_command_latency_seconds", "summary", "Time from the reception of a command to its answer, quantiles over the process lifetime are interpolated within " + std::to_string(LATENCY_SUB_BUCKETS) + " buckets per power of two of microseconds.");
+        for (int command = 0; command < static_cast<int>(Command::COUNT); command++)
+        {
+            uint64_t count = 0;
+            for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+                count += s.latency[command][bucket];
+            for (double quantile : {0.5, 0.9, 0.99})
+            {
+                text << "montezuma_command_latency_seconds{command=\"" << commandNames[command] << "\",quantile=\"" << quantile << "\"} ";
+                if (count)
+                    text << latencyQuantile(s.latency[command], count, quantile) << "\n";
+                else
+                    text << "NaN\n";
+            }
+            text << "montezuma_command_latency_seconds_sum{command=\"" << commandNames[command] << "\"} " << s.latencyMicros[command] / 1e6 << "\n";
+            text << "montezuma_command_latency_seconds_count{command=\"" << commandNames[command] << "\"} " << count << "\n";
+        }
+        return text.str();
+    }
+
+    void Metrics::setExportTarget(const std::string &target)
+    {
+        stopExport();
+        if (target.empty() || target.compare("<empty>") == 0)
+            return;
+        std::lock_guard<std::mutex> lock(exportMutex_);
+        exportTarget_ = target;
+        stopping_ = false;
+        exporter_ = std::thread(&Metrics::exportLoop, this);
+    }
+
+    void Metrics::setExportInterval(unsigned int seconds)
+    {
+        std::lock_guard<std::mutex> lock(exportMutex_);
+        exportInterval_ = std::chrono::seconds(std::max(1u, seconds));
+        exportStop_.notify_all();
+    }
+
+    void Metrics::stopExport()
+    {
+        {
+            std::lock_guard<std::mutex> lock(exportMutex_);
+            stopping_ = true;
+            exportStop_.notify_all();
+        }
+        if (exporter_.joinable())
+            exporter_.join();
+    }
+
+    void Metrics::exportLoop()
+    {
+        std::unique_lock<std::mutex> lock(exportMutex_);
+        bool failing = false;
+        while (!stopping_)
+        {
+            std::string target = exportTarget_;
+            lock.unlock();
+            bool written = writeMetrics(target, prometheusText());
+            if (written == failing) // Only report changes, not every failed attempt
+                std::cout << "info string metrics export to " << target << (written ? " resumed" : " failed") << std::endl;
+            failing = !written;
+            lock.lock();
+            exportStop_.wait_for(lock, exportInterval_);
+        }
+    }
+
+    bool Metrics::writeMetrics(const std::string &target, const std::string &text) const
+    {
+        if (target.compare(0, 5, "unix:") != 0)
+        { // Replace the file at once, so that readers never see a partial export
+            std::string temporary = target + ".tmp";
+            {
+                std::ofstream file(temporary, std::ios::trunc);
+                file << text;
+                if (!file.flush())
+                    return false;
+            }
+            std::error_code error;
+            std::filesystem::rename(temporary, target, error);
+            return !error;
+        }
+#ifndef _WIN32
+        std::string path = target.substr(5);
+        sockaddr_un address{};
+        if (path.size() >= sizeof(address.sun_path))
+            return false;
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+        int socketFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (socketFd < 0)
+            return false;
+#ifdef MSG_NOSIGNAL
+        int sendFlags = MSG_NOSIGNAL; // A scraper going away must not kill the engine
+#else
+        int sendFlags = 0;
+#endif
+        size_t sent = 0;
+        if (connect(socketFd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0)
+        {
+            while (sent < text.size())
+            {
+                ssize_t written = send(socketFd, text.data() + sent, text.size() - sent, sendFlags);
+                if (written <= 0)
+                    break;
+                sent += written;
+            }
+        }
+        close(socketFd);
+        return sent == text.size();
+#else
+        return false; // No Unix sockets here
+#endif
+    }
+
+} // end namespace montezuma
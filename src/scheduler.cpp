@@ -0,0 +1,231 @@
+#include <algorithm>
+#include <filesystem>
+#include "scheduler.h"
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+namespace montezuma
+{
+
+    // Start of the time slice of the search running on this thread
+    static thread_local std::chrono::steady_clock::time_point sliceStart;
+    // Lock file of the host-wide slot held by the search running on this thread, -1 if none
+    static thread_local int hostSlotFd = -1;
+    // Last time the search running on this thread looked for waiting searches of other processes
+    static thread_local std::chrono::steady_clock::time_point lastHostCheck;
+
+    Scheduler::Scheduler()
+    {
+        slots_ = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    Scheduler &Scheduler::instance()
+    {
+        static Scheduler scheduler;
+        return scheduler;
+    }
+
+    void Scheduler::setSlots(unsigned int slots)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        slots_ = std::max(1u, slots);
+        slotFreed_.notify_all();
+    }
+
+    unsigned int Scheduler::slots() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return slots_;
+    }
+
+    bool Scheduler::setSlotDirectory(const std::string &directory)
+    {
+        if (!directory.empty())
+        {
+#ifdef _WIN32
+            return false; // Lock files rely on flock()
+#else
+            std::error_code ignored;
+            std::filesystem::create_directories(directory, ignored);
+            int fd = open((directory + "/slot-0.lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+            if (fd < 0)
+                return false;
+            close(fd);
+#endif
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        slotDirectory_ = directory;
+        return true;
+    }
+
+    void Scheduler::acquire(SearchClass searchClass)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        takeSlot(searchClass, lock);
+    }
+
+    void Scheduler::release(SearchClass searchClass)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        giveSlot(searchClass);
+    }
+
+    std::chrono::microseconds Scheduler::checkpoint(SearchClass searchClass)
+    {
+        if (searchClass == SearchClass::INTERACTIVE)
+            return std::chrono::microseconds(0); // Interactive searches are never suspended
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto now = std::chrono::steady_clock::now();
+        bool sliceOver = now - sliceStart >= timeSlice_;
+        bool yield = interactiveWaiting_ > 0 || (sliceOver && !batchQueue_.empty()) || busySlots_ > slots_;
+        if (!yield && hostSlotFd >= 0 && now - lastHostCheck >= hostCheckInterval_)
+        { // Same rules for the searches waiting in the other processes sharing the slots
+            lastHostCheck = now;
+            std::string directory = slotDirectory_;
+            lock.unlock();
+            yield = hostWaiting(directory + "/interactive.lock") || (sliceOver && hostWaiting(directory + "/batch.lock"));
+            lock.lock();
+        }
+        if (!yield)
+            return std::chrono::microseconds(0);
+        stats_[static_cast<int>(searchClass)].preemptions++;
+        auto suspended = std::chrono::steady_clock::now();
+        giveSlot(searchClass);
+        takeSlot(searchClass, lock, true);
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - suspended);
+    }
+
+    void Scheduler::recordSearch(SearchClass searchClass, unsigned long long nodes)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_[static_cast<int>(searchClass)].searches++;
+        stats_[static_cast<int>(searchClass)].nodes += nodes;
+    }
+
+    schedulerStats Scheduler::stats(SearchClass searchClass) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_[static_cast<int>(searchClass)];
+    }
+
+    void Scheduler::takeSlot(SearchClass searchClass, std::unique_lock<std::mutex> &lock, bool yielded)
+    {
+        auto startWait = std::chrono::steady_clock::now();
+        waitForSlot(searchClass, lock);
+        std::string directory = slotDirectory_;
+        if (!directory.empty())
+        {
+            lock.unlock();
+            acquireHostSlot(searchClass, directory, slots_, yielded);
+            lock.lock();
+        }
+        sliceStart = lastHostCheck = std::chrono::steady_clock::now();
+        schedulerStats &stats = stats_[static_cast<int>(searchClass)];
+        unsigned long long waitMs = std::chrono::duration_cast<std::chrono::milliseconds>(sliceStart - startWait).count();
+        stats.waitMs += waitMs;
+        stats.maxWaitMs = std::max(stats.maxWaitMs, waitMs);
+    }
+
+    void Scheduler::giveSlot(SearchClass searchClass)
+    {
+        releaseHostSlot();
+        freeSlot(searchClass);
+    }
+
+    void Scheduler::waitForSlot(SearchClass searchClass, std::unique_lock<std::mutex> &lock)
+    {
+        if (searchClass == SearchClass::INTERACTIVE)
+        {
+            interactiveWaiting_++;
+            slotFreed_.wait(lock, [this]()
+                            { return busySlots_ < slots_; });
+            interactiveWaiting_--;
+        }
+        else
+        { // Batch searches only get a slot nobody interactive is waiting for, in order of arrival
+            unsigned long long ticket = nextTicket_++;
+            batchQueue_.push_back(ticket);
+            slotFreed_.wait(lock, [this, ticket]()
+                            { return interactiveWaiting_ == 0 && busySlots_ < slots_ && batchQueue_.front() == ticket; });
+            batchQueue_.pop_front();
+        }
+        busySlots_++;
+        slotFreed_.notify_all(); // The next batch search in line may be able to run too
+    }
+
+    void Scheduler::freeSlot(SearchClass searchClass)
+    {
+        busySlots_--;
+        stats_[static_cast<int>(searchClass)].runMs += std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - sliceStart).count();
+        slotFreed_.notify_all();
+    }
+
+#ifndef _WIN32
+    void Scheduler::acquireHostSlot(SearchClass searchClass, const std::string &directory, unsigned int slots, bool yielded)
+    {
+        if (yielded)
+        { // Let the searches already waiting take the slot given away before competing again, as batchQueue_ does
+            // in this process. Bounded, in case they cannot get a slot for some other reason
+            auto giveUp = std::chrono::steady_clock::now() + timeSlice_;
+            while ((hostWaiting(directory + "/interactive.lock") || hostWaiting(directory + "/batch.lock")) &&
+                   std::chrono::steady_clock::now() < giveUp)
+                std::this_thread::sleep_for(hostPollInterval_);
+        }
+        // Announce the wait: batch searches of other processes make room for interactive ones, and end their time slice for batch ones
+        std::string marker = directory + (searchClass == SearchClass::INTERACTIVE ? "/interactive.lock" : "/batch.lock");
+        int waitingFd = open(marker.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+        if (waitingFd >= 0)
+            flock(waitingFd, LOCK_SH);
+        while (hostSlotFd < 0)
+        {
+            bool usable = false; // Whether any slot file could be opened at all
+            if (searchClass == SearchClass::INTERACTIVE || !hostWaiting(directory + "/interactive.lock"))
+            {
+                for (unsigned int i = 0; i < slots && hostSlotFd < 0; i++)
+                {
+                    int fd = open((directory + "/slot-" + std::to_string(i) + ".lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+                    if (fd < 0)
+                        continue;
+                    usable = true;
+                    if (flock(fd, LOCK_EX | LOCK_NB) == 0)
+                        hostSlotFd = fd;
+                    else
+                        close(fd);
+                }
+                if (!usable)
+                    break; // The directory went away, run unrestricted rather than hang
+            }
+            if (hostSlotFd < 0)
+                std::this_thread::sleep_for(hostPollInterval_);
+        }
+        if (waitingFd >= 0)
+            close(waitingFd);
+    }
+
+    void Scheduler::releaseHostSlot()
+    {
+        if (hostSlotFd < 0)
+            return;
+        close(hostSlotFd); // Also releases the lock
+        hostSlotFd = -1;
+    }
+
+    bool Scheduler::hostWaiting(const std::string &marker) const
+    {
+        int fd = open(marker.c_str(), O_RDWR | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+        bool waiting = flock(fd, LOCK_EX | LOCK_NB) != 0; // Waiting searches hold it shared
+        close(fd);
+        return waiting;
+    }
+#else
+    void Scheduler::acquireHostSlot(SearchClass, const std::string &, unsigned int, bool) {}
+    void Scheduler::releaseHostSlot() {}
+    bool Scheduler::hostWaiting(const std::string &) const { return false; }
+#endif
+
+} // end namespace montezuma
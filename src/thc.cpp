@@ -30,6 +30,12 @@
 #include <assert.h>
 #include <algorithm>
 #include "thc.h"
+#include <stdint.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
 using namespace std;
 using namespace thc;
 /****************************************************************************
@@ -3081,38 +3087,7 @@ void ChessEvaluation::Planning()
     }
 }
 
-/****************************************************************************
- * Evaluate a position, leaf node
- *
- *   (this makes a rather ineffectual effort to score positional features
- *    needs a lot of improvement)
- ****************************************************************************/
-void ChessEvaluation::EvaluateLeaf( int &material, int &positional )
-{
-    //DIAG_evaluate_leaf_count++;
-    char   piece;
-    int file;
-    int bonus = 0;
-    int score_black_material = 0;
-    int score_white_material = 0;
-    int black_connected=0;
-    int white_connected=0;
-
-    int white_king_safety_bonus          =0;
-    int white_king_central_bonus         =0;
-    int white_queen_central_bonus        =0;
-    int white_queen_developed_bonus      =0;
-    int white_queen78_bonus              =0;
-    int white_undeveloped_minor_bonus    =0;
-
-    int black_king_safety_bonus          =0;
-    int black_king_central_bonus         =0;
-    int black_queen_central_bonus        =0;
-    int black_queen_developed_bonus      =0;
-    int black_queen78_bonus              =0;
-    int black_undeveloped_minor_bonus    =0;
-
-
+// Bonus values for the positional features scored by EvaluateLeaf()
 #define BONUS_WHITE_SWAP_PIECE          60
 #define BONUS_BLACK_SWAP_PIECE          -60
 #define BONUS_BLACK_CONNECTED_ROOKS     -10
@@ -3158,10 +3133,387 @@ void ChessEvaluation::EvaluateLeaf( int &material, int &positional )
 #define BONUS_WHITE_PAWN_CENTRAL         5
 #define BONUS_STRONG_KING                50
 
-const int MATERIAL_OPENING = (500 + ((8*10+4*30+2*50+90)*2)/3);
-const int MATERIAL_MIDDLE  = (500 + ((8*10+4*30+2*50+90)*1)/3);
+// Material thresholds separating the opening, middlegame and ending phases of each side
+static const int MATERIAL_OPENING = (500 + ((8*10+4*30+2*50+90)*2)/3);
+static const int MATERIAL_MIDDLE  = (500 + ((8*10+4*30+2*50+90)*1)/3);
+
+/****************************************************************************
+ * Linear leaf evaluation
+ *
+ *   EvaluateLeaf() extracts a dense vector of int16 features (piece counts
+ *   and the number of occurrences of each BONUS_* term) and scores it with
+ *   dot products against weight vectors, AVX2 pmaddwd when available. The
+ *   weights are the BONUS_* constants, so the result is identical to the
+ *   original branchy scan, still available with THC_CLASSIC_LEAF_EVALUATION
+ ****************************************************************************/
+#ifndef THC_CLASSIC_LEAF_EVALUATION
+
+// Feature lanes, in four blocks of 16 int16s (one AVX2 register each)
+enum
+{
+    // Block 0, piece counts (weighted by material tables)
+    LEAF_P, LEAF_N, LEAF_B, LEAF_R, LEAF_Q, LEAF_K,
+    LEAF_p, LEAF_n, LEAF_b, LEAF_r, LEAF_q, LEAF_k,
+    LEAF_NBR_PIECE_LANES,
+    LEAF_SINK=15,           // no feature
+
+    // Block 1, white features scored in every phase
+    LEAF_WHITE_CONNECTED_ROOKS=16,
+    LEAF_WHITE_BLOCKED_BISHOP,
+    LEAF_WHITE_KNIGHT_CENTRAL0,
+    LEAF_WHITE_KNIGHT_CENTRAL1,
+    LEAF_WHITE_KNIGHT_CENTRAL2,
+    LEAF_WHITE_KNIGHT_CENTRAL3,
+    LEAF_WHITE_ROOK7,
+    LEAF_WHITE_PAWN5,
+    LEAF_WHITE_PAWN6,
+    LEAF_WHITE_PAWN7,
+    LEAF_WHITE_PAWN_CENTRAL,
+    LEAF_WHITE_STRONG_KING,
+
+    // Block 2, black features scored in every phase
+    LEAF_BLACK_CONNECTED_ROOKS=32,
+    LEAF_BLACK_BLOCKED_BISHOP,
+    LEAF_BLACK_KNIGHT_CENTRAL0,
+    LEAF_BLACK_KNIGHT_CENTRAL1,
+    LEAF_BLACK_KNIGHT_CENTRAL2,
+    LEAF_BLACK_KNIGHT_CENTRAL3,
+    LEAF_BLACK_ROOK7,
+    LEAF_BLACK_PAWN5,
+    LEAF_BLACK_PAWN6,
+    LEAF_BLACK_PAWN7,
+    LEAF_BLACK_PAWN_CENTRAL,
+    LEAF_BLACK_STRONG_KING,
+
+    // Block 3, features whose weight depends on the phase of their side
+    LEAF_WHITE_KING_SAFETY=48,
+    LEAF_WHITE_QUEEN_DEVELOPED,
+    LEAF_WHITE_UNDEVELOPED_MINOR,
+    LEAF_WHITE_QUEEN_CENTRAL,
+    LEAF_WHITE_QUEEN78,
+    LEAF_BLACK_KING_SAFETY=56,
+    LEAF_BLACK_QUEEN_DEVELOPED,
+    LEAF_BLACK_UNDEVELOPED_MINOR,
+    LEAF_BLACK_QUEEN_CENTRAL,
+    LEAF_BLACK_QUEEN78,
+
+    LEAF_NBR_LANES=64
+};
+
+// Phases, selected for each side by its own material
+enum { LEAF_OPENING, LEAF_MIDDLE, LEAF_ENDING, LEAF_NBR_PHASES };
+
+// Piece of each count lane
+static const char leaf_pieces[LEAF_NBR_PIECE_LANES+1] = "PNBRQKpnbrqk";
+
+// Squares where a kind of piece scores a feature
+struct LEAF_SQUARE_FEATURE
+{
+    int lane;               // piece
+    int feature;            // feature lane
+    uint64_t mask;          // bit n = square n
+    bool flag;              // scored once, however many pieces are on the squares
+};
+
+struct LEAF_TABLES
+{
+    alignas(32) short material[4][16];      // white material, black material, white pieces, black pieces
+    alignas(32) short common[32];           // blocks 1 and 2
+    alignas(32) short phased[LEAF_NBR_PHASES][LEAF_NBR_PHASES][16];  // block 3, [white phase][black phase]
+    LEAF_SQUARE_FEATURE square_features[32];
+    int nbr_square_features;
+    LEAF_TABLES();
+};
+
+LEAF_TABLES::LEAF_TABLES()
+{
+    memset( this, 0, sizeof(*this) );
+    for( int lane=LEAF_P; lane<=LEAF_k; lane++ )
+    {
+        int piece = leaf_pieces[lane];
+        material[0][lane] = white_material[piece];
+        material[1][lane] = black_material[piece];
+        material[2][lane] = white_pieces[piece];
+        material[3][lane] = black_pieces[piece];
+    }
+
+    // Features that only depend on the square a piece stands on
+    for( int lane=LEAF_P; lane<=LEAF_k; lane++ )
+    {
+        for( int square=0; square<64; square++ )
+        {
+            int file = IFILE(square);
+            int rank = IRANK(square)+1;
+            bool central = (2<=file && file<=5);
+            int feature = LEAF_SINK;
+            switch( lane )
+            {
+                case LEAF_N:
+                    if( rank==1 )
+                        feature = LEAF_WHITE_UNDEVELOPED_MINOR;
+                    else if( 3<=rank && rank<=6 && central )
+                        feature = LEAF_WHITE_KNIGHT_CENTRAL0 + (rank-3);
+                    break;
+                case LEAF_n:
+                    if( rank==8 )
+                        feature = LEAF_BLACK_UNDEVELOPED_MINOR;
+                    else if( 3<=rank && rank<=6 && central )
+                        feature = LEAF_BLACK_KNIGHT_CENTRAL0 + (6-rank);
+                    break;
+                case LEAF_B:
+                    if( rank==1 )
+                        feature = LEAF_WHITE_UNDEVELOPED_MINOR;
+                    break;
+                case LEAF_b:
+                    if( rank==8 )
+                        feature = LEAF_BLACK_UNDEVELOPED_MINOR;
+                    break;
+                case LEAF_R:
+                    if( rank==7 )
+                        feature = LEAF_WHITE_ROOK7;
+                    break;
+                case LEAF_r:
+                    if( rank==2 )
+                        feature = LEAF_BLACK_ROOK7;
+                    break;
+                case LEAF_Q:
+                    if( rank>=7 )
+                        feature = LEAF_WHITE_QUEEN78;
+                    else if( rank>=3 )
+                        feature = LEAF_WHITE_QUEEN_CENTRAL;
+                    else if( rank==2 && central )
+                        feature = LEAF_WHITE_QUEEN_DEVELOPED;
+                    break;
+                case LEAF_q:
+                    if( rank<=2 )
+                        feature = LEAF_BLACK_QUEEN78;
+                    else if( rank<=6 )
+                        feature = LEAF_BLACK_QUEEN_CENTRAL;
+                    else if( rank==7 && central )
+                        feature = LEAF_BLACK_QUEEN_DEVELOPED;
+                    break;
+                case LEAF_K:
+                    if( rank<=2 && !central )
+                        feature = LEAF_WHITE_KING_SAFETY;
+                    break;
+                case LEAF_k:
+                    if( rank>=7 && !central )
+                        feature = LEAF_BLACK_KING_SAFETY;
+                    break;
+                case LEAF_P:
+                    if( (rank==5 && (file==3 || file==4)) || (rank==4 && central) )
+                        feature = LEAF_WHITE_PAWN_CENTRAL;
+                    break;
+                case LEAF_p:
+                    if( (rank==4 && (file==3 || file==4)) || (rank==5 && central) )
+                        feature = LEAF_BLACK_PAWN_CENTRAL;
+                    break;
+            }
+            if( feature == LEAF_SINK )
+                continue;
+            int i;
+            for( i=0; i<nbr_square_features; i++ )
+            {
+                if( square_features[i].lane==lane && square_features[i].feature==feature )
+                    break;
+            }
+            if( i == nbr_square_features )
+            {
+                nbr_square_features++;
+                square_features[i].lane = lane;
+                square_features[i].feature = feature;
+                square_features[i].flag = (feature==LEAF_WHITE_KING_SAFETY || feature==LEAF_WHITE_QUEEN_DEVELOPED ||
+                                           feature==LEAF_WHITE_QUEEN_CENTRAL || feature==LEAF_WHITE_QUEEN78 ||
+                                           feature==LEAF_BLACK_KING_SAFETY || feature==LEAF_BLACK_QUEEN_DEVELOPED ||
+                                           feature==LEAF_BLACK_QUEEN_CENTRAL || feature==LEAF_BLACK_QUEEN78);
+            }
+            square_features[i].mask |= (1ULL << square);
+        }
+    }
+
+    short *white = common;
+    short *black = common+16;
+    white[LEAF_WHITE_CONNECTED_ROOKS-16] = BONUS_WHITE_CONNECTED_ROOKS;
+    white[LEAF_WHITE_BLOCKED_BISHOP-16]  = BONUS_WHITE_BLOCKED_BISHOP;
+    white[LEAF_WHITE_KNIGHT_CENTRAL0-16] = BONUS_WHITE_KNIGHT_CENTRAL0;
+    white[LEAF_WHITE_KNIGHT_CENTRAL1-16] = BONUS_WHITE_KNIGHT_CENTRAL1;
+    white[LEAF_WHITE_KNIGHT_CENTRAL2-16] = BONUS_WHITE_KNIGHT_CENTRAL2;
+    white[LEAF_WHITE_KNIGHT_CENTRAL3-16] = BONUS_WHITE_KNIGHT_CENTRAL3;
+    white[LEAF_WHITE_ROOK7-16]           = BONUS_WHITE_ROOK7;
+    white[LEAF_WHITE_PAWN5-16]           = BONUS_WHITE_PAWN5;
+    white[LEAF_WHITE_PAWN6-16]           = BONUS_WHITE_PAWN6;
+    white[LEAF_WHITE_PAWN7-16]           = BONUS_WHITE_PAWN7;
+    white[LEAF_WHITE_PAWN_CENTRAL-16]    = BONUS_WHITE_PAWN_CENTRAL;
+    white[LEAF_WHITE_STRONG_KING-16]     = BONUS_STRONG_KING;
+    black[LEAF_BLACK_CONNECTED_ROOKS-32] = BONUS_BLACK_CONNECTED_ROOKS;
+    black[LEAF_BLACK_BLOCKED_BISHOP-32]  = BONUS_BLACK_BLOCKED_BISHOP;
+    black[LEAF_BLACK_KNIGHT_CENTRAL0-32] = BONUS_BLACK_KNIGHT_CENTRAL0;
+    black[LEAF_BLACK_KNIGHT_CENTRAL1-32] = BONUS_BLACK_KNIGHT_CENTRAL1;
+    black[LEAF_BLACK_KNIGHT_CENTRAL2-32] = BONUS_BLACK_KNIGHT_CENTRAL2;
+    black[LEAF_BLACK_KNIGHT_CENTRAL3-32] = BONUS_BLACK_KNIGHT_CENTRAL3;
+    black[LEAF_BLACK_ROOK7-32]           = BONUS_BLACK_ROOK7;
+    black[LEAF_BLACK_PAWN5-32]           = BONUS_BLACK_PAWN5;
+    black[LEAF_BLACK_PAWN6-32]           = BONUS_BLACK_PAWN6;
+    black[LEAF_BLACK_PAWN7-32]           = BONUS_BLACK_PAWN7;
+    black[LEAF_BLACK_PAWN_CENTRAL-32]    = BONUS_BLACK_PAWN_CENTRAL;
+    black[LEAF_BLACK_STRONG_KING-32]     = -BONUS_STRONG_KING;
+
+    // Every combination of the phases of the two sides gets its own weights
+    for( int white_phase=0; white_phase<LEAF_NBR_PHASES; white_phase++ )
+    {
+        for( int black_phase=0; black_phase<LEAF_NBR_PHASES; black_phase++ )
+        {
+            short *weights = phased[white_phase][black_phase];
+            if( white_phase == LEAF_OPENING )
+            {
+                weights[LEAF_WHITE_KING_SAFETY-48]        = BONUS_WHITE_KING_SAFETY;
+                weights[LEAF_WHITE_QUEEN_DEVELOPED-48]    = BONUS_WHITE_QUEEN_DEVELOPED;
+                weights[LEAF_WHITE_UNDEVELOPED_MINOR-48]  = WHITE_UNDEVELOPED_MINOR_BONUS;
+            }
+            else if( white_phase == LEAF_MIDDLE )
+            {
+                weights[LEAF_WHITE_KING_SAFETY-48]        = BONUS_WHITE_KING_SAFETY;
+                weights[LEAF_WHITE_QUEEN_CENTRAL-48]      = BONUS_WHITE_QUEEN_CENTRAL;
+            }
+            else
+                weights[LEAF_WHITE_QUEEN78-48]            = BONUS_WHITE_QUEEN78;
+            if( black_phase == LEAF_OPENING )
+            {
+                weights[LEAF_BLACK_KING_SAFETY-48]        = BONUS_BLACK_KING_SAFETY;
+                weights[LEAF_BLACK_QUEEN_DEVELOPED-48]    = BONUS_BLACK_QUEEN_DEVELOPED;
+                weights[LEAF_BLACK_UNDEVELOPED_MINOR-48]  = BLACK_UNDEVELOPED_MINOR_BONUS;
+            }
+            else if( black_phase == LEAF_MIDDLE )
+            {
+                weights[LEAF_BLACK_KING_SAFETY-48]        = BONUS_BLACK_KING_SAFETY;
+                weights[LEAF_BLACK_QUEEN_CENTRAL-48]      = BONUS_BLACK_QUEEN_CENTRAL;
+            }
+            else
+                weights[LEAF_BLACK_QUEEN78-48]            = BONUS_BLACK_QUEEN78;
+        }
+    }
+}
 
+static const LEAF_TABLES leaf_tables;
 
+// Dot product of nbr_lanes (a multiple of 16) features and weights, both 32 byte aligned
+static inline int LeafDot( const short *features, const short *weights, int nbr_lanes )
+{
+#if defined(__AVX2__)
+    __m256i sum = _mm256_setzero_si256();
+    for( int i=0; i<nbr_lanes; i+=16 )
+    {
+        __m256i f = _mm256_load_si256( (const __m256i *)(features+i) );
+        __m256i w = _mm256_load_si256( (const __m256i *)(weights+i) );
+        sum = _mm256_add_epi32( sum, _mm256_madd_epi16(f,w) );
+    }
+    __m128i sum128 = _mm_add_epi32( _mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum,1) );
+    sum128 = _mm_add_epi32( sum128, _mm_shuffle_epi32(sum128,0x4e) );
+    sum128 = _mm_add_epi32( sum128, _mm_shuffle_epi32(sum128,0xb1) );
+    return _mm_cvtsi128_si32( sum128 );
+#else
+    int sum = 0;
+    for( int i=0; i<nbr_lanes; i++ )
+        sum += features[i]*weights[i];
+    return sum;
+#endif
+}
+
+static inline int LeafPopCount( uint64_t bits )
+{
+#if defined(__GNUC__) && defined(__POPCNT__)
+    return __builtin_popcountll( bits );
+#elif defined(_MSC_VER) && defined(__AVX2__)
+    return (int)__popcnt64( bits );
+#else
+    int count = 0;
+    for( ; bits; bits &= bits-1 )
+        count++;
+    return count;
+#endif
+}
+
+// Lowest square of a non empty bitboard
+static inline Square LeafFirstSquare( uint64_t bits )
+{
+#if defined(__GNUC__)
+    return (Square)__builtin_ctzll( bits );
+#elif defined(_MSC_VER) && defined(_M_X64)
+    unsigned long square;
+    _BitScanForward64( &square, bits );
+    return (Square)square;
+#else
+    int square = 0;
+    while( !(bits & (1ULL << square)) )
+        square++;
+    return (Square)square;
+#endif
+}
+
+// Bitboard of each kind of piece, bit n = square n
+static inline void LeafBitboards( const char *squares, uint64_t bitboards[LEAF_NBR_PIECE_LANES] )
+{
+#if defined(__AVX2__)
+    __m256i first  = _mm256_loadu_si256( (const __m256i *)squares );
+    __m256i second = _mm256_loadu_si256( (const __m256i *)(squares+32) );
+    for( int lane=0; lane<LEAF_NBR_PIECE_LANES; lane++ )
+    {
+        __m256i piece = _mm256_set1_epi8( leaf_pieces[lane] );
+        uint64_t low  = (uint32_t)_mm256_movemask_epi8( _mm256_cmpeq_epi8(first,piece) );
+        uint64_t high = (uint32_t)_mm256_movemask_epi8( _mm256_cmpeq_epi8(second,piece) );
+        bitboards[lane] = low | (high<<32);
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    __m128i quarters[4];
+    for( int i=0; i<4; i++ )
+        quarters[i] = _mm_loadu_si128( (const __m128i *)(squares+16*i) );
+    for( int lane=0; lane<LEAF_NBR_PIECE_LANES; lane++ )
+    {
+        __m128i piece = _mm_set1_epi8( leaf_pieces[lane] );
+        uint64_t bits = 0;
+        for( int i=0; i<4; i++ )
+            bits |= (uint64_t)(uint16_t)_mm_movemask_epi8( _mm_cmpeq_epi8(quarters[i],piece) ) << (16*i);
+        bitboards[lane] = bits;
+    }
+#else
+    for( int lane=0; lane<LEAF_NBR_PIECE_LANES; lane++ )
+        bitboards[lane] = 0;
+    for( int square=0; square<64; square++ )
+    {
+        const char *piece = (squares[square]==' ' ? NULL : strchr(leaf_pieces,squares[square]));
+        if( piece )
+            bitboards[piece-leaf_pieces] |= (1ULL << square);
+    }
+#endif
+}
+
+// Blocked bishop test for a bishop on the first two ranks of its side, as in the classic scan
+//  (corner bishops only look at the one diagonal they have)
+static inline bool LeafBlockedBishop( int file, char left, char right, bool black )
+{
+    bool left_blocked  = black ? IsBlack(left)  : IsWhite(left);
+    bool right_blocked = black ? IsBlack(right) : IsWhite(right);
+    if( file == 0 )
+        return right_blocked;
+    if( file == 7 )
+        return left_blocked;
+    return left_blocked && right_blocked;
+}
+
+#endif // THC_CLASSIC_LEAF_EVALUATION
+
+/****************************************************************************
+ * Evaluate a position, leaf node
+ *
+ *   (this makes a rather ineffectual effort to score positional features
+ *    needs a lot of improvement)
+ ****************************************************************************/
+void ChessEvaluation::EvaluateLeaf( int &material, int &positional )
+{
+    //DIAG_evaluate_leaf_count++;
+    int bonus = 0;
+    int score_black_material = 0;
+    int score_white_material = 0;
     Square black_king_square = SQUARE_INVALID;
     Square white_king_square = SQUARE_INVALID;
     Square black_pawns_buf[16];
@@ -3175,6 +3527,26 @@ const int MATERIAL_MIDDLE  = (500 + ((8*10+4*30+2*50+90)*1)/3);
     int score_black_pieces = 0;
     int score_white_pieces = 0;
 
+#ifdef THC_CLASSIC_LEAF_EVALUATION
+    char   piece;
+    int file;
+    int black_connected=0;
+    int white_connected=0;
+
+    int white_king_safety_bonus          =0;
+    int white_king_central_bonus         =0;
+    int white_queen_central_bonus        =0;
+    int white_queen_developed_bonus      =0;
+    int white_queen78_bonus              =0;
+    int white_undeveloped_minor_bonus    =0;
+
+    int black_king_safety_bonus          =0;
+    int black_king_central_bonus         =0;
+    int black_queen_central_bonus        =0;
+    int black_queen_developed_bonus      =0;
+    int black_queen78_bonus              =0;
+    int black_undeveloped_minor_bonus    =0;
+
     // a8->h8
     for( Square square=a8; square<=h8; ++square )
     {
@@ -3904,6 +4276,127 @@ const int MATERIAL_MIDDLE  = (500 + ((8*10+4*30+2*50+90)*1)/3);
         // bonus += black_king_central_bonus;
         bonus += black_queen78_bonus;
     }
+#else
+    // Bitboards of every kind of piece, from which the features are counted
+    const LEAF_TABLES &t = leaf_tables;
+    alignas(32) short features[LEAF_NBR_LANES] = {0};
+    uint64_t bitboards[LEAF_NBR_PIECE_LANES];
+    LeafBitboards( squares, bitboards );
+    for( int lane=0; lane<LEAF_NBR_PIECE_LANES; lane++ )
+        features[lane] = LeafPopCount( bitboards[lane] );
+    for( int i=0; i<t.nbr_square_features; i++ )
+    {
+        const LEAF_SQUARE_FEATURE &square_feature = t.square_features[i];
+        uint64_t bits = bitboards[square_feature.lane] & square_feature.mask;
+        if( bits )
+            features[square_feature.feature] += (square_feature.flag ? 1 : LeafPopCount(bits));
+    }
+    #define LEAF_RANK(lane,rank) ((unsigned int)(bitboards[lane] >> (8*(rank))) & 0xff)   // bit n = file n, rank 0 = 8th rank
+    #define LEAF_RANKS_8_7 0x000000000000ffffULL
+    #define LEAF_RANKS_2_1 0xffff000000000000ULL
+
+    score_white_material = LeafDot( features, t.material[0], 16 );
+    score_black_material = LeafDot( features, t.material[1], 16 );
+    score_white_pieces   = LeafDot( features, t.material[2], 16 );
+    score_black_pieces   = LeafDot( features, t.material[3], 16 );
+
+    if( bitboards[LEAF_K] )
+    {
+        white_king_square = LeafFirstSquare( bitboards[LEAF_K] );
+        bonus += king_ending_bonus_dynamic_white[white_king_square];
+    }
+    if( bitboards[LEAF_k] )
+    {
+        black_king_square = LeafFirstSquare( bitboards[LEAF_k] );
+        bonus -= king_ending_bonus_dynamic_black[black_king_square];
+    }
+
+    // Connected rooks, when the first two pieces of the back rank are the rooks
+    unsigned int back_rank = LEAF_RANK(LEAF_r,0) | LEAF_RANK(LEAF_n,0) | LEAF_RANK(LEAF_b,0) | LEAF_RANK(LEAF_q,0) | LEAF_RANK(LEAF_k,0);
+    unsigned int after_first = back_rank & (back_rank-1);
+    unsigned int first_two = back_rank & ~(after_first & (after_first-1));
+    if( after_first && (first_two & LEAF_RANK(LEAF_r,0)) == first_two )
+        features[LEAF_BLACK_CONNECTED_ROOKS] = 1;
+    back_rank = LEAF_RANK(LEAF_R,7) | LEAF_RANK(LEAF_N,7) | LEAF_RANK(LEAF_B,7) | LEAF_RANK(LEAF_Q,7) | LEAF_RANK(LEAF_K,7);
+    after_first = back_rank & (back_rank-1);
+    first_two = back_rank & ~(after_first & (after_first-1));
+    if( after_first && (first_two & LEAF_RANK(LEAF_R,7)) == first_two )
+        features[LEAF_WHITE_CONNECTED_ROOKS] = 1;
+
+    // Blocked bishops on the first two ranks of their side
+    for( uint64_t bits=bitboards[LEAF_b] & LEAF_RANKS_8_7; bits; bits&=bits-1 )
+    {
+        Square square = LeafFirstSquare( bits );
+        if( LeafBlockedBishop( IFILE(square), squares[SW(square)], squares[SE(square)], true ) )
+            features[LEAF_BLACK_BLOCKED_BISHOP]++;
+    }
+    for( uint64_t bits=bitboards[LEAF_B] & LEAF_RANKS_2_1; bits; bits&=bits-1 )
+    {
+        Square square = LeafFirstSquare( bits );
+        if( LeafBlockedBishop( IFILE(square), squares[NW(square)], squares[NE(square)], false ) )
+            features[LEAF_WHITE_BLOCKED_BISHOP]++;
+    }
+
+    // Pawns on the 7th, 6th and 5th rank are passed unless an enemy pawn further ahead
+    //  stands on the same or an adjacent file
+    static const int white_passer_lanes[] = { LEAF_WHITE_PAWN7, LEAF_WHITE_PAWN6, LEAF_WHITE_PAWN5 };
+    static const int black_passer_lanes[] = { LEAF_BLACK_PAWN7, LEAF_BLACK_PAWN6, LEAF_BLACK_PAWN5 };
+    uint64_t white_passed = 0;
+    uint64_t black_passed = 0;
+    unsigned int black_pawns_ahead = 0;
+    unsigned int white_pawns_ahead = 0;
+    for( int i=0; i<3; i++ )
+    {
+        int white_rank = 1+i;   // 7th rank first
+        int black_rank = 6-i;   // 2nd rank first
+        unsigned int white_files = LEAF_RANK(LEAF_P,white_rank) & ~black_pawns_ahead;
+        unsigned int black_files = LEAF_RANK(LEAF_p,black_rank) & ~white_pawns_ahead;
+        features[white_passer_lanes[i]] = LeafPopCount( white_files );
+        features[black_passer_lanes[i]] = LeafPopCount( black_files );
+        white_passed |= (uint64_t)white_files << (8*white_rank);
+        black_passed |= (uint64_t)black_files << (8*black_rank);
+        black_files = LEAF_RANK(LEAF_p,white_rank);
+        white_files = LEAF_RANK(LEAF_P,black_rank);
+        black_pawns_ahead |= black_files | (black_files<<1) | (black_files>>1);
+        white_pawns_ahead |= white_files | (white_files<<1) | (white_files>>1);
+    }
+    for( uint64_t bits=bitboards[LEAF_P]; bits; bits&=bits-1 )
+    {
+        Square square = LeafFirstSquare( bits );
+        *white_pawns++ = square;
+        if( white_passed & (1ULL << square) )
+        {
+            *white_passers++ = square;
+            #ifdef USE_STRONG_KING
+            Square ahead = NORTH(square);
+            if( squares[ahead]=='K' && king_ending_bonus_dynamic_white[ahead]==0 )
+                features[LEAF_WHITE_STRONG_KING]++;
+            #endif
+        }
+    }
+    for( uint64_t bits=bitboards[LEAF_p]; bits; bits&=bits-1 )
+    {
+        Square square = LeafFirstSquare( bits );
+        *black_pawns++ = square;
+        if( black_passed & (1ULL << square) )
+        {
+            *black_passers++ = square;
+            #ifdef USE_STRONG_KING
+            Square ahead = SOUTH(square);
+            if( squares[ahead]=='k' && king_ending_bonus_dynamic_black[ahead]==0 )
+                features[LEAF_BLACK_STRONG_KING]++;
+            #endif
+        }
+    }
+
+    int white_phase = score_white_material > MATERIAL_OPENING ? LEAF_OPENING : (score_white_material > MATERIAL_MIDDLE ? LEAF_MIDDLE : LEAF_ENDING);
+    int black_phase = score_black_material < -MATERIAL_OPENING ? LEAF_OPENING : (score_black_material < -MATERIAL_MIDDLE ? LEAF_MIDDLE : LEAF_ENDING);
+    bonus += LeafDot( features+16, t.common, 32 );
+    bonus += LeafDot( features+48, t.phased[white_phase][black_phase], 16 );
+    #undef LEAF_RANK
+    #undef LEAF_RANKS_8_7
+    #undef LEAF_RANKS_2_1
+#endif
 
     material   = score_white_material + score_black_material;
     if( white )
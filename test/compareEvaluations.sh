@@ -0,0 +1,26 @@
+#! /bin/sh
+# Usage: compareEvaluations.sh <reference evaluation> <evaluation>...
+# Every build of the leaf evaluation must score the positions exactly as the reference one
+
+reference_build=$1
+shift
+reference=$(mktemp) && output=$(mktemp) || exit 1
+trap 'rm -f "$reference" "$output"' EXIT
+
+"$reference_build" > "$reference" || exit 1
+for evaluation in "$@"; do
+    case "$evaluation" in
+        *Avx2*)
+            if ! grep -qw avx2 /proc/cpuinfo 2>/dev/null; then
+                echo "Skipping $evaluation, this CPU does not support AVX2"
+                continue
+            fi;;
+    esac
+    "$evaluation" > "$output" || exit 1
+    if ! cmp -s "$reference" "$output"; then
+        echo "$evaluation scores positions differently from $reference_build:"
+        diff "$reference" "$output" | head -6
+        exit 1
+    fi
+    echo "$evaluation agrees with $reference_build on $(wc -l < "$reference") positions"
+done
@@ -0,0 +1,36 @@
+#! /bin/sh
+# Usage: expandBook.sh <montezuma_bookexpand> <montezuma>
+# Grows a book from an empty one, resumes an expansion from its journal and plays from the result
+
+bookexpand=$1
+engine=$2
+work=$(mktemp -d) || exit 1
+trap 'rm -rf "$work"' EXIT
+cd "$work" || exit 1
+
+fail() {
+    echo "$1"
+    exit 1
+}
+
+# An empty book has the initial position as its only frontier position
+: > empty.bin
+"$bookexpand" empty.bin first.bin --depth 3 --threads 2 > first.log || fail "Expanding an empty book failed"
+grep -q "wrote 1 entries (1 new)" first.log || fail "Expected the initial position to be added: $(cat first.log)"
+"$bookexpand" first.bin second.bin --depth 3 > second.log || fail "Expanding a one move book failed"
+grep -q "wrote 2 entries (1 new)" second.log || fail "Expected the reply to the book move to be added: $(cat second.log)"
+
+# The journal holds every search result, so running again searches nothing and writes the same book
+mv second.bin expected.bin
+"$bookexpand" first.bin second.bin --depth 3 > resumed.log || fail "Resuming the expansion failed"
+grep -q "0 to search" resumed.log || fail "Expected every position to come from the journal: $(cat resumed.log)"
+cmp -s expected.bin second.bin || fail "The resumed expansion wrote a different book"
+
+# The engine plays the book move instead of searching
+(printf "uci\nsetoption name bookPath value second.bin\nisready\nposition startpos\ngo\n"; sleep 1; echo quit) | "$engine" > engine.log
+grep -q "read 2 entries from opening book" engine.log || fail "The engine could not read the expanded book"
+grep -q "^bestmove" engine.log || fail "The engine did not answer from the book"
+if grep -q "info score" engine.log; then
+    fail "The engine searched a position of the book"
+fi
+echo "Expanded, resumed and played a book"
@@ -0,0 +1,35 @@
+/*
+ * Prints the leaf evaluation of a fixed set of positions, reached by random games played from a fixed seed.
+ * Built once per evaluation variant, the outputs are compared by compareEvaluations.sh.
+ */
+
+#include <iostream>
+#include <random>
+#include <vector>
+#include "thc.h"
+
+int main()
+{
+    std::mt19937 rng(12345); // The sequence of mt19937 is fully specified, every build plays the same games
+    for (int game = 0; game < 500; game++)
+    {
+        thc::ChessEvaluation cr;
+        if (game % 7 == 3)
+        { // Sorting the moves runs the planning, which changes the weights of some features
+            std::vector<thc::Move> sorted;
+            cr.GenLegalMoveListSorted(sorted);
+        }
+        for (int ply = 0; ply < 160; ply++)
+        {
+            std::vector<thc::Move> moves;
+            cr.GenLegalMoveList(moves);
+            if (moves.empty())
+                break;
+            cr.PlayMove(moves[rng() % moves.size()]);
+            int material, positional;
+            cr.EvaluateLeaf(material, positional);
+            std::cout << cr.ForsythPublish() << " " << material << " " << positional << "\n";
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,37 @@
+#! /bin/sh
+# Usage: prepareData.sh <montezuma_dataprep> <problems file>
+# Prepares the positions of a problems file, given three times over, and checks the chunks hold each of them once
+
+dataprep=$1
+problems=$2
+work=$(mktemp -d) || exit 1
+trap 'rm -rf "$work"' EXIT
+
+fail() {
+    echo "$1"
+    exit 1
+}
+
+# Problems files alternate a FEN line and a solution line
+awk 'NR % 2 == 1' "$problems" > "$work/positions.txt"
+unique=$(sort -u "$work/positions.txt" | wc -l)
+cat "$work/positions.txt" "$work/positions.txt" > "$work/first.txt"
+(cat "$work/positions.txt"; echo "not a position") > "$work/second.txt"
+
+"$dataprep" "$work/out" "$work/first.txt" "$work/second.txt" --chunk 50 --threads 2 --memory 1 > "$work/dataprep.log" ||
+    fail "Preparing the data failed: $(cat "$work/dataprep.log")"
+grep -q "wrote $unique positions" "$work/dataprep.log" || fail "Expected $unique unique positions: $(cat "$work/dataprep.log")"
+grep -q "1 malformed lines skipped" "$work/dataprep.log" || fail "Expected the malformed line to be skipped: $(cat "$work/dataprep.log")"
+[ "$(cat "$work"/out/chunk-*.txt | sort -u | wc -l)" -eq "$unique" ] || fail "The chunks do not hold every position once"
+[ "$(cat "$work"/out/chunk-*.txt | wc -l)" -eq "$unique" ] || fail "The chunks hold duplicate positions"
+
+# Every chunk but the last one is full
+last=$(ls "$work"/out/chunk-*.txt | tail -n 1)
+for chunk in "$work"/out/chunk-*.txt; do
+    lines=$(wc -l < "$chunk")
+    if [ "$chunk" != "$last" ] && [ "$lines" -ne 50 ]; then
+        fail "$chunk holds $lines positions instead of 50"
+    fi
+done
+[ "$(wc -l < "$last")" -eq $(( (unique - 1) % 50 + 1 )) ] || fail "$last does not hold the remaining positions"
+echo "Prepared $unique unique positions"